@@ -0,0 +1,94 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef _GNU_SOURCE
+# define _GNU_SOURCE 1 /* memfd_create, O_TMPFILE */
+#endif // _GNU_SOURCE
+#include <config.h>
+#include <anonfile.h>
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif // HAVE_FCNTL_H
+#ifdef HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif // HAVE_SYS_MMAN_H
+#ifdef HAVE_UNISTD_H
+# include <unistd.h>
+#endif // HAVE_UNISTD_H
+
+/**
+ * lp_anon_file_new:
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Creates a file with no name, either in memory the kernel may
+ * page out (memfd) or in the temporary directory, which is gone
+ * as soon as it is closed (and unmapped).
+ *
+ * Returns: a file descriptor open for reading and writing, or -1.
+*/
+gint lp_anon_file_new (GError** error)
+{
+  gchar* name = NULL;
+  gint fd = -1;
+
+#ifdef HAVE_MEMFD_CREATE
+  if ((fd = memfd_create ("lpacked", MFD_CLOEXEC)) >= 0)
+    return fd;
+#endif // HAVE_MEMFD_CREATE
+#if defined (O_TMPFILE) && defined (O_CLOEXEC)
+  if ((fd = open (g_get_tmp_dir (), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) >= 0)
+    return fd;
+#endif // O_TMPFILE && O_CLOEXEC
+  if ((fd = g_file_open_tmp ("lpacked-XXXXXX", &name, error)) >= 0)
+    g_unlink (name);
+return (g_free (name), fd);
+}
+
+/**
+ * lp_anon_file_write:
+ * @fd: file descriptor from #lp_anon_file_new.
+ * @data: (array length=size): data to append.
+ * @size: length of @data.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Appends @data to @fd, retrying short (or interrupted) writes.
+ *
+ * Returns: if operation was successful.
+*/
+gboolean lp_anon_file_write (gint fd, gconstpointer data, gsize size, GError** error)
+{
+  const gchar* next = data;
+  gssize wrote;
+  gint errsv;
+
+  while (size > 0)
+    {
+      if ((wrote = write (fd, next, size)) >= 0)
+        {
+          next += wrote;
+          size -= wrote;
+        }
+      else if ((errsv = errno) != EINTR)
+        {
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv), "write()!: %s", g_strerror (errsv));
+          return FALSE;
+        }
+    }
+return TRUE;
+}
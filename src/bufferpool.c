@@ -0,0 +1,103 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <bufferpool.h>
+
+/*
+ * Buffers are page aligned (which suits both the kernel copying
+ * into them and libarchive/liblzma walking them) and, once
+ * released, kept around up to LP_BUFFER_POOL_KEEP per size so
+ * opening many streams does not allocate each time
+ */
+#define LP_BUFFER_POOL_ALIGNMENT (4096)
+#define LP_BUFFER_POOL_KEEP (16)
+
+typedef struct _Bucket Bucket;
+
+/* free buffers are chained through their first bytes */
+struct _Bucket
+{
+  gpointer head;
+  guint count;
+};
+
+static GMutex lock;
+static GHashTable* pool = NULL;
+
+/**
+ * lp_buffer_pool_acquire:
+ * @size: buffer size.
+ *
+ * Takes a buffer of @size bytes from the shared pool, allocating
+ * a new one if none is available.
+ *
+ * Returns: (transfer full): a buffer to be given back to the
+ * pool with #lp_buffer_pool_release.
+*/
+gpointer lp_buffer_pool_acquire (gsize size)
+{
+  Bucket* bucket = NULL;
+  gpointer buffer = NULL;
+
+  g_return_val_if_fail (size >= sizeof (gpointer), NULL);
+  g_mutex_lock (&lock);
+
+  if (pool != NULL && (bucket = g_hash_table_lookup (pool, GSIZE_TO_POINTER (size))) != NULL && bucket->head != NULL)
+    {
+      buffer = bucket->head;
+      bucket->head = *(gpointer*) buffer;
+      bucket->count--;
+    }
+
+  g_mutex_unlock (&lock);
+
+  if (buffer == NULL)
+    buffer = g_aligned_alloc (1, size, LP_BUFFER_POOL_ALIGNMENT);
+return buffer;
+}
+
+/**
+ * lp_buffer_pool_release:
+ * @buffer: (transfer full): buffer taken with #lp_buffer_pool_acquire.
+ * @size: size @buffer was acquired with.
+ *
+ * Gives @buffer back to the shared pool.
+*/
+void lp_buffer_pool_release (gpointer buffer, gsize size)
+{
+  Bucket* bucket = NULL;
+
+  if (buffer == NULL)
+    return;
+
+  g_mutex_lock (&lock);
+
+  if (G_UNLIKELY (pool == NULL))
+    pool = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  if ((bucket = g_hash_table_lookup (pool, GSIZE_TO_POINTER (size))) == NULL)
+    g_hash_table_insert (pool, GSIZE_TO_POINTER (size), bucket = g_new0 (Bucket, 1));
+
+  if (bucket->count < LP_BUFFER_POOL_KEEP)
+    {
+      *(gpointer*) buffer = bucket->head;
+      bucket->head = g_steal_pointer (&buffer);
+      bucket->count++;
+    }
+
+  g_mutex_unlock (&lock);
+  g_aligned_free (buffer);
+}
@@ -0,0 +1,32 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LP_BUFFER_POOL__
+#define __LP_BUFFER_POOL__ 1
+#include <glib.h>
+
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  gpointer lp_buffer_pool_acquire (gsize size);
+  void lp_buffer_pool_release (gpointer buffer, gsize size);
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
+#endif // __LP_BUFFER_POOL__
@@ -17,8 +17,12 @@
 #include <config.h>
 #include <archive.h>
 #include <archive_entry.h>
+#include <bufferpool.h>
 #include <builder.h>
 #include <format.h>
+#include <gvdb/gvdb-builder.h>
+#include <lzma.h>
+#include <packindex.h>
 
 typedef struct _Source Source;
 
@@ -29,6 +33,8 @@ struct _LpPackBuilder
   /* <private> */
   GKeyFile* manifest;
   GHashTable* sources;
+  LpPackLayout layout;
+  guint buffer_size;
 };
 
 struct _Source
@@ -40,13 +46,19 @@ struct _Source
 enum
 {
   prop_0,
+  prop_buffer_size,
   prop_name,
   prop_description,
+  prop_layout,
   prop_number,
 };
 
 G_DEFINE_FINAL_TYPE (LpPackBuilder, lp_pack_builder, G_TYPE_OBJECT);
 G_DEFINE_QUARK (lp-pack-builder-error-quark, lp_pack_builder_error);
+G_DEFINE_ENUM_TYPE (LpPackLayout, lp_pack_layout,
+  G_DEFINE_ENUM_VALUE (LP_PACK_LAYOUT_SOLID, "solid"),
+  G_DEFINE_ENUM_VALUE (LP_PACK_LAYOUT_RANDOM, "random"),
+  G_DEFINE_ENUM_VALUE (LP_PACK_LAYOUT_STORED, "stored"));
 
 static GParamSpec* properties [prop_number] = {0};
 
@@ -93,6 +105,8 @@ static void lp_pack_builder_class_get_property (GObject* pself, guint property_i
       default: G_OBJECT_WARN_INVALID_PROPERTY_ID (pself, property_id, pspec); break;
       case prop_name: g_value_take_string (value, g_key_file_get_string (self->manifest, LP_PACK_MANIFEST_GROUP, LP_PACK_MANIFEST_KEY_NAME, NULL)); break;
       case prop_description: g_value_take_string (value, g_key_file_get_string (self->manifest, LP_PACK_MANIFEST_GROUP, LP_PACK_MANIFEST_KEY_DESCRIPTION, NULL)); break;
+      case prop_layout: g_value_set_enum (value, self->layout); break;
+      case prop_buffer_size: g_value_set_uint (value, self->buffer_size); break;
     }
 }
 
@@ -105,6 +119,8 @@ static void lp_pack_builder_class_set_property (GObject* pself, guint property_i
       default: G_OBJECT_WARN_INVALID_PROPERTY_ID (pself, property_id, pspec); break;
       case prop_name: g_key_file_set_string (self->manifest, LP_PACK_MANIFEST_GROUP, LP_PACK_MANIFEST_KEY_NAME, g_value_get_string (value)); break;
       case prop_description: g_key_file_set_string (self->manifest, LP_PACK_MANIFEST_GROUP, LP_PACK_MANIFEST_KEY_DESCRIPTION, g_value_get_string (value)); break;
+      case prop_layout: self->layout = g_value_get_enum (value); break;
+      case prop_buffer_size: self->buffer_size = g_value_get_uint (value); break;
     }
 }
 
@@ -115,8 +131,10 @@ static void lp_pack_builder_class_init (LpPackBuilderClass* klass)
   G_OBJECT_CLASS (klass)->get_property = lp_pack_builder_class_get_property;
   G_OBJECT_CLASS (klass)->set_property = lp_pack_builder_class_set_property;
 
+  properties [prop_buffer_size] = g_param_spec_uint ("buffer-size", "buffer-size", "buffer-size", 512, G_MAXUINT, LP_PACK_BUFFER_SIZE, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
   properties [prop_name] = g_param_spec_string ("name", "name", "name", NULL, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
   properties [prop_description] = g_param_spec_string ("description", "description", "description", NULL, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+  properties [prop_layout] = g_param_spec_enum ("layout", "layout", "layout", LP_TYPE_PACK_LAYOUT, LP_PACK_LAYOUT_SOLID, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
   g_object_class_install_properties (G_OBJECT_CLASS (klass), prop_number, properties);
 }
 
@@ -279,20 +297,71 @@ struct _Writer
 {
   GOutputStream* stream;
   GError* error;
+  guint64 offset;
+  GHashTable* entries;
+
+  gboolean compress;
+  guint64 block;
+  lzma_stream xz;
+  guint8* buffer;
+  gsize buffer_size;
 };
 
 typedef struct archive Archive;
 typedef struct archive_entry ArchiveEntry;
 typedef struct _Writer Writer;
 
+static gboolean pump (Writer* writer, lzma_action action, GError** error)
+{
+  lzma_stream* xz = &writer->xz;
+  guint8* buffer = writer->buffer;
+  lzma_ret ret;
+  gsize wrote;
+
+  do
+    {
+      xz->next_out = buffer;
+      xz->avail_out = writer->buffer_size;
+
+      if ((ret = lzma_code (xz, action)), G_UNLIKELY (ret != LZMA_OK && ret != LZMA_STREAM_END))
+        {
+          g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_WRITE, "lzma_code()!: error %u", (guint) ret);
+          return FALSE;
+        }
+      else if (g_output_stream_write_all (writer->stream, buffer, writer->buffer_size - xz->avail_out, &wrote, NULL, error) == FALSE)
+        return FALSE;
+
+      writer->offset += wrote;
+    }
+  while (xz->avail_in > 0 || (action != LZMA_RUN && ret != LZMA_STREAM_END));
+return TRUE;
+}
+
 static la_ssize_t on_write (struct archive* ar, void* user_data, const void* buffer, size_t count)
 {
   GOutputStream* stream = G_STRUCT_MEMBER (gpointer, user_data, G_STRUCT_OFFSET (Writer, stream));
   GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Writer, error));
+  gboolean compress = G_STRUCT_MEMBER (gboolean, user_data, G_STRUCT_OFFSET (Writer, compress));
+  lzma_stream* xz = & G_STRUCT_MEMBER (lzma_stream, user_data, G_STRUCT_OFFSET (Writer, xz));
   gssize wrote = 0;
 
-  if ((wrote = g_output_stream_write (stream, buffer, (gsize) count, NULL, error)) < 0)
+  if (compress)
+    {
+      xz->next_in = buffer;
+      xz->avail_in = count;
+
+      if (pump (user_data, LZMA_RUN, error) == FALSE)
+        wrote = ARCHIVE_FATAL;
+      else
+        {
+          wrote = (gssize) count;
+          G_STRUCT_MEMBER (guint64, user_data, G_STRUCT_OFFSET (Writer, block)) += wrote;
+        }
+    }
+  else if ((wrote = g_output_stream_write (stream, buffer, (gsize) count, NULL, error)) < 0)
         wrote = ARCHIVE_FATAL;
+  else
+    G_STRUCT_MEMBER (guint64, user_data, G_STRUCT_OFFSET (Writer, offset)) += wrote;
 return (la_ssize_t) wrote;
 }
 
@@ -314,14 +383,37 @@ return (la_ssize_t) wrote;
       } \
   } G_STMT_END
 
+static gboolean cutblock (Writer* writer, GError** error)
+{
+  /*
+   * Start a new xz block once the current one grows past
+   * LP_PACK_BLOCK_SIZE, so readers can decode from there
+   * on using the xz block index
+   */
+  if (writer->compress && writer->block >= LP_PACK_BLOCK_SIZE)
+    {
+      if (G_UNLIKELY (pump (writer, LZMA_FULL_FLUSH, error) == FALSE))
+        return FALSE;
+
+      writer->block = 0;
+    }
+return TRUE;
+}
+
 static int begin_file (Archive* ar, const gchar* name, gsize size, Writer* writer, GError** error)
 {
   ArchiveEntry* ent = NULL;
   const gchar* path = NULL;
+  guint64 offset;
   int result;
 
+  /* small entries then fit in (and are decoded from) a single block */
+  if (G_UNLIKELY (cutblock (writer, error) == FALSE))
+    return ARCHIVE_FATAL;
+
   ent = archive_entry_new2 (ar);
   path = g_path_skip_root (name);
+  offset = archive_filter_bytes (ar, 0);
 
   archive_entry_set_pathname (ent, path);
   archive_entry_set_size (ent, size);
@@ -329,7 +421,10 @@ static int begin_file (Archive* ar, const gchar* name, gsize size, Writer* write
   archive_entry_set_perm (ent, 0644);
 
   if ((result = archive_write_header (ar, ent)), G_LIKELY (result == ARCHIVE_OK))
-    archive_entry_free (ent);
+    {
+      lp_pack_index_add (writer->entries, ent, offset);
+      archive_entry_free (ent);
+    }
   else
     {
       archive_entry_free (ent);
@@ -368,18 +463,47 @@ static int write_manifest (LpPackBuilder* self, Archive* ar, Writer* writer, GEr
 return result;
 }
 
+static gboolean write_index (LpPackBuilder* self, Writer* writer, GError** error)
+{
+  const gchar zeroes [LP_PACK_INDEX_ALIGNMENT] = {0};
+  LpPackTrailer trailer = {0};
+  GHashTable* root = NULL;
+  GString* data = NULL;
+  gboolean good = FALSE;
+  gsize padding;
+
+  padding = (LP_PACK_INDEX_ALIGNMENT - (writer->offset % LP_PACK_INDEX_ALIGNMENT)) % LP_PACK_INDEX_ALIGNMENT;
+  root = lp_pack_index_new_root (self->manifest, self->layout, writer->entries);
+
+  data = gvdb_table_serialize (root, FALSE);
+
+  memcpy (trailer.magic, LP_PACK_INDEX_MAGIC, sizeof (trailer.magic));
+  trailer.length = GUINT64_TO_LE (writer->offset);
+  trailer.offset = GUINT64_TO_LE (writer->offset + padding);
+  trailer.size = GUINT64_TO_LE ((guint64) data->len);
+
+  good = g_output_stream_write_all (writer->stream, zeroes, padding, NULL, NULL, error)
+      && g_output_stream_write_all (writer->stream, data->str, data->len, NULL, NULL, error)
+      && g_output_stream_write_all (writer->stream, &trailer, sizeof (trailer), NULL, NULL, error);
+
+  g_hash_table_unref (root);
+  g_string_free (data, TRUE);
+return good;
+}
+
 static int write_archive (LpPackBuilder* self, Archive* ar, Writer* writer, GError** error)
 {
   GError* tmperr = NULL;
   GHashTableIter iter = {0};
   const gchar* name = NULL;
   const Source* source = NULL;
-  gchar buffer [512];
+  gchar* buffer = NULL;
   gint result;
 
   if ((result = write_manifest (self, ar, writer, error)), G_UNLIKELY (result != ARCHIVE_OK))
     return result;
 
+  buffer = lp_buffer_pool_acquire (self->buffer_size);
   g_hash_table_iter_init (&iter, self->sources);
 
   while (g_hash_table_iter_next (&iter, (gpointer*) &name, (gpointer*) &source))
@@ -387,36 +511,46 @@ static int write_archive (LpPackBuilder* self, Archive* ar, Writer* writer, GErr
       if ((result = begin_file (ar, name, source->size, writer, error)), G_UNLIKELY (result != ARCHIVE_OK))
         break;
 
-      while (TRUE)
+      /*
+       * Large entries span several blocks, which readers
+       * use as checkpoints when seeking inside them
+       */
+      while (result == ARCHIVE_OK)
         {
           la_ssize_t done;
-          gsize read;
+          gssize read;
 
-          if ((read = g_input_stream_read (source->stream, buffer, sizeof (buffer), NULL, error)) < 0)
-            return ARCHIVE_FATAL;
+          if ((read = g_input_stream_read (source->stream, buffer, self->buffer_size, NULL, error)) < 0)
+            result = ARCHIVE_FATAL;
           else if (read == 0) break;
+          else if (G_UNLIKELY (cutblock (writer, error) == FALSE))
+            result = ARCHIVE_FATAL;
           else
             {
               if ((done = archive_write_data (ar, buffer, read)), G_UNLIKELY (done < 0))
                 {
+                  result = ARCHIVE_FATAL;
                   report (error, archive_write_data, ar, writer);
-                  return ARCHIVE_FATAL;
                 }
               else if (done < read)
                 {
+                  result = ARCHIVE_FATAL;
                   archive_set_error (ar, ARCHIVE_FATAL, "partial write");
                   report (error, archive_write_data, ar, writer);
-                  return ARCHIVE_FATAL;
                 }
             }
         }
 
-      if ((result = archive_write_finish_entry (ar)), G_UNLIKELY (result != ARCHIVE_OK))
+      if (G_UNLIKELY (result != ARCHIVE_OK))
+        break;
+      else if ((result = archive_write_finish_entry (ar)), G_UNLIKELY (result != ARCHIVE_OK))
         {
           report (error, archive_write_finish_entry, ar, writer);
           break;
         }
     }
+
+  lp_buffer_pool_release (buffer, self->buffer_size);
 return result;
 }
 
@@ -436,16 +570,39 @@ gboolean lp_pack_builder_write_to_stream (LpPackBuilder* builder, GOutputStream*
   g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
   Archive* ar = archive_write_new ();
-  Writer writer = { stream, NULL, };
+  Writer writer = { .stream = stream, .entries = gvdb_hash_table_new (NULL, NULL), };
+  const gboolean random = builder->layout != LP_PACK_LAYOUT_SOLID;
+  const gchar* method = builder->layout == LP_PACK_LAYOUT_STORED ? LP_PACK_STORED_METHOD : LP_PACK_RANDOM_METHOD;
   int result = ARCHIVE_OK;
+  lzma_ret ret;
 
   G_STATIC_ASSERT (sizeof (la_ssize_t) == sizeof (gssize));
   G_STATIC_ASSERT (sizeof (size_t) == sizeof (gsize));
 
-  if ((result = archive_write_add_filter (ar, LP_PACK_COMPRESSION)), G_UNLIKELY (result != ARCHIVE_OK))
+  /*
+   * Solid packs are xz compressed here instead of by a libarchive
+   * filter, so block boundaries can be placed between entries
+   * (see begin_file). Output is still a regular xz stream, and
+   * only then is a buffer needed to pump it through (see pump)
+   */
+  if ((writer.compress = !random))
+    writer.buffer = lp_buffer_pool_acquire (writer.buffer_size = builder->buffer_size);
+
+  if (!random && (ret = lzma_easy_encoder (&writer.xz, LZMA_PRESET_DEFAULT, LZMA_CHECK_CRC64), G_UNLIKELY (ret != LZMA_OK)))
+    {
+      result = ARCHIVE_FATAL;
+      g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_OPEN, "lzma_easy_encoder()!: error %u", (guint) ret);
+    }
+  else if ((result = archive_write_add_filter (ar, random ? LP_PACK_RANDOM_COMPRESSION : ARCHIVE_FILTER_NONE)), G_UNLIKELY (result != ARCHIVE_OK))
     g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_OPEN, "archive_write_add_filter()!: %s", archive_error_string (ar));
-  else if ((result = archive_write_set_format (ar, LP_PACK_FORMAT)), G_UNLIKELY (result != ARCHIVE_OK))
+  else if ((result = archive_write_set_format (ar, random ? LP_PACK_RANDOM_FORMAT : LP_PACK_FORMAT)), G_UNLIKELY (result != ARCHIVE_OK))
     g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_OPEN, "archive_write_set_format()!: %s", archive_error_string (ar));
+  else if (random && (result = archive_write_set_format_option (ar, "zip", "compression", method), G_UNLIKELY (result != ARCHIVE_OK)))
+    g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_OPEN, "archive_write_set_format_option()!: %s", archive_error_string (ar));
+  else if (random && (result = archive_write_set_bytes_in_last_block (ar, 1), G_UNLIKELY (result != ARCHIVE_OK)))
+    g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_OPEN, "archive_write_set_bytes_in_last_block()!: %s", archive_error_string (ar));
+  else if (!random && (result = archive_write_set_bytes_per_block (ar, 0), G_UNLIKELY (result != ARCHIVE_OK)))
+    g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_OPEN, "archive_write_set_bytes_per_block()!: %s", archive_error_string (ar));
   else if ((result = archive_write_open2 (ar, &writer, NULL, on_write, NULL, NULL)), G_UNLIKELY (result != ARCHIVE_OK))
     g_set_error (error, LP_PACK_BUILDER_ERROR, LP_PACK_BUILDER_ERROR_OPEN, "archive_write_open2()!: %s", archive_error_string (ar));
   else
@@ -464,6 +621,21 @@ gboolean lp_pack_builder_write_to_stream (LpPackBuilder* builder, GOutputStream*
               g_set_error (error, domain, code, "archive_write_close()!: %s", message);
             }
         }
+
+      if (G_LIKELY (result == ARCHIVE_OK) && writer.compress)
+        {
+          if (pump (&writer, LZMA_FINISH, error) == FALSE)
+            result = ARCHIVE_FATAL;
+        }
+
+      if (G_LIKELY (result == ARCHIVE_OK))
+        {
+          if (write_index (builder, &writer, error) == FALSE)
+            result = ARCHIVE_FATAL;
+        }
     }
-return (archive_write_free (ar), result == ARCHIVE_OK);
+
+  lzma_end (&writer.xz);
+  lp_buffer_pool_release (writer.buffer, writer.buffer_size);
+return (g_hash_table_unref (writer.entries), archive_write_free (ar), result == ARCHIVE_OK);
 }
@@ -19,6 +19,7 @@
 #include <gio/gio.h>
 
 #define LP_TYPE_PACK_BUILDER (lp_pack_builder_get_type ())
+#define LP_TYPE_PACK_LAYOUT (lp_pack_layout_get_type ())
 #define LP_PACK_BUILDER_ERROR (lp_pack_builder_error_quark ())
 
 typedef enum
@@ -29,6 +30,13 @@ typedef enum
   LP_PACK_BUILDER_ERROR_CLOSE,
 } LpPackBuilderError;
 
+typedef enum
+{
+  LP_PACK_LAYOUT_SOLID,
+  LP_PACK_LAYOUT_RANDOM,
+  LP_PACK_LAYOUT_STORED,
+} LpPackLayout;
+
 #if __cplusplus
 extern "C" {
 #endif // __cplusplus
@@ -36,6 +44,7 @@ extern "C" {
   G_DECLARE_FINAL_TYPE (LpPackBuilder, lp_pack_builder, LP, PACK_BUILDER, GObject);
 
   GQuark lp_pack_builder_error_quark (void) G_GNUC_CONST;
+  GType lp_pack_layout_get_type (void) G_GNUC_CONST;
 
   gchar* lp_canonicalize_alias (const gchar* path, const gchar* alias);
   gchar* lp_canonicalize_pack_name (const gchar* pack_name);
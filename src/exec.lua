@@ -24,9 +24,7 @@ do
   local function exec (main, files)
     local reader = Lp.PackReader ()
 
-    for _, file in ipairs (files) do
-      assert (reader:add_from_file (file))
-    end
+    assert (reader:add_from_files (files))
 
     assert (reader:contains (main), ('no such file \'%s\''):format (main))
 
@@ -53,20 +51,8 @@ do
     end
 
     local function loadpath (name)
-      local info = assert (reader:query_info (name, 'standard::size'))
-      local stream = assert (reader:open (name))
-      local left = info:get_size ()
-
-      return load (function ()
-          if (left == 0) then
-            return nil
-          else
-            local bytes = stream:read_bytes (left)
-            local done = bytes:get_size ()
-              left = left - done
-            return bytes:get_data ()
-          end
-        end, '=' .. name)
+      local bytes = assert (reader:lookup_bytes (name))
+      return load (bytes:get_data (), '=' .. name)
     end
 
     local function searcher (name)
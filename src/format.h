@@ -17,13 +17,107 @@
 #ifndef __LP_PACK_FORMAT__
 #define __LP_PACK_FORMAT__ 1
 #include <archive.h>
+#include <glib.h>
 
 #define LP_PACK_COMPRESSION ARCHIVE_COMPRESSION_XZ
 #define LP_PACK_FORMAT ARCHIVE_FORMAT_TAR_PAX_RESTRICTED
 
+/*
+ * Solid packs are split into xz blocks of (about) this many
+ * uncompressed bytes, starting at an entry header unless an
+ * entry is large enough to span several of them
+ */
+#define LP_PACK_BLOCK_SIZE (1 << 20)
+
+#define LP_PACK_RANDOM_COMPRESSION ARCHIVE_FILTER_NONE
+#define LP_PACK_RANDOM_FORMAT ARCHIVE_FORMAT_ZIP
+#define LP_PACK_RANDOM_METHOD "deflate"
+
+/*
+ * Stored packs are random access packs whose entries are not
+ * compressed at all, so a mapped pack can hand out entry data
+ * without copying it
+ */
+#define LP_PACK_STORED_METHOD "store"
+
 #define LP_PACK_MANIFEST_PATH "manifest"
 #define LP_PACK_MANIFEST_GROUP "LPacked Application"
 #define LP_PACK_MANIFEST_KEY_NAME "name"
 #define LP_PACK_MANIFEST_KEY_DESCRIPTION "description"
 
+#define LP_PACK_INDEX_ALIGNMENT (8)
+#define LP_PACK_INDEX_MAGIC "LPINDEX1"
+#define LP_PACK_INDEX_ENTRIES "entries"
+#define LP_PACK_INDEX_LAYOUT "layout"
+#define LP_PACK_INDEX_MANIFEST "manifest"
+
+/*
+ * Every index entry is keyed by its path and holds:
+ * (offset, size, mode, flags, atime, ctime, birthtime)
+ * where offset is the position of the entry header in the
+ * uncompressed archive stream (solid layout) or in the pack
+ * itself (random and stored layouts), and every time is a pair
+ * (seconds, nanoseconds) only meaningful if its bit is set
+ * in flags.
+ */
+#define LP_PACK_INDEX_ENTRY "(ttuu(xu)(xu)(xu))"
+#define LP_PACK_INDEX_HAS_ATIME (1 << 0)
+#define LP_PACK_INDEX_HAS_CTIME (1 << 1)
+#define LP_PACK_INDEX_HAS_BIRTHTIME (1 << 2)
+
+/*
+ * Packs without an index get one built by the reader on first scan
+ * and saved under the user cache directory. Such caches are regular
+ * indexes with extra root keys identifying the pack they describe:
+ * its size, modification time (in microseconds) and a digest of its
+ * first and last LP_PACK_CACHE_SAMPLE bytes
+ */
+#define LP_PACK_CACHE_DIR "lpacked"
+#define LP_PACK_CACHE_DIGEST "digest"
+#define LP_PACK_CACHE_MTIME "mtime"
+#define LP_PACK_CACHE_SAMPLE (65536)
+#define LP_PACK_CACHE_SIZE "size"
+
+/*
+ * Solid packs made of a single xz block may also be recoded (with
+ * LP_PACK_CACHE_PRESET) into blocks of LP_PACK_BLOCK_SIZE, kept
+ * next to the cache (its name plus LP_PACK_CACHE_RECODED_SUFFIX)
+ * and decoded from instead by later scans, so they can be seeked
+ * into as well. Caches record its size under LP_PACK_CACHE_RECODED.
+ * Since a recoded copy is about as large as the pack itself, this is
+ * only done for packs no larger than LpPackReader:recode-limit
+ */
+#define LP_PACK_CACHE_PRESET (1)
+#define LP_PACK_CACHE_RECODED "recoded"
+#define LP_PACK_CACHE_RECODED_SUFFIX ".xz"
+
+/*
+ * Streams reading ahead (see LpPackReader:read-ahead) have
+ * entries decompressed in chunks of this many bytes
+ */
+#define LP_PACK_READ_AHEAD_CHUNK (65536)
+
+/*
+ * Default size of the buffers packs are read into and
+ * builders read source files with
+ */
+#define LP_PACK_BUFFER_SIZE (1 << 17)
+
+typedef struct _LpPackTrailer LpPackTrailer;
+
+/*
+ * Trailer appended after the archive data, all fields are
+ * little endian. The index (a GVDB table) lives in range
+ * [offset, offset + size), and archive data in [0, length)
+ */
+struct _LpPackTrailer
+{
+  gchar magic [8];
+  guint64 length;
+  guint64 offset;
+  guint64 size;
+};
+
+G_STATIC_ASSERT (sizeof (LpPackTrailer) == 32);
+
 #endif // __LP_PACK_FORMAT__
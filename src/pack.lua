@@ -60,7 +60,7 @@ do
 
     do
       -- Check fields
-      local optional = { description = 'string', main = 'string', }
+      local optional = { description = 'string', layout = 'string', main = 'string', }
       local mandatory = { name = 'string', pack = 'table', }
 
       for field, type_ in pairs (optional) do
@@ -86,6 +86,7 @@ do
 
     builder.name = desc.name
     builder.description = desc.description
+    builder.layout = desc.layout and desc.layout:upper () or 'SOLID'
 
     local function addfile (alias, filename, prefix)
       if (type (alias) == 'number') then
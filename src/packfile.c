@@ -0,0 +1,502 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <packfile.h>
+#include <pathindex.h>
+#include <string.h>
+
+struct _LpPackFile
+{
+  GObject parent;
+
+  /* <private> */
+  LpPackReader* reader;
+  gchar* name;
+  gchar* path;
+};
+
+struct _LpPackFileEnumerator
+{
+  GFileEnumerator parent;
+
+  /* <private> */
+  gchar* attributes;
+  gchar** names;
+  guint next;
+};
+
+struct _LpPackFileInputStream
+{
+  GFileInputStream parent;
+
+  /* <private> */
+  GInputStream* base;
+  LpPackFile* file;
+};
+
+static void lp_pack_file_g_file_iface_init (GFileIface* iface);
+G_DEFINE_FINAL_TYPE_WITH_CODE (LpPackFile, lp_pack_file, G_TYPE_OBJECT,
+  G_IMPLEMENT_INTERFACE (G_TYPE_FILE, lp_pack_file_g_file_iface_init));
+G_DECLARE_FINAL_TYPE (LpPackFileEnumerator, lp_pack_file_enumerator, LP, PACK_FILE_ENUMERATOR, GFileEnumerator);
+G_DEFINE_FINAL_TYPE (LpPackFileEnumerator, lp_pack_file_enumerator, G_TYPE_FILE_ENUMERATOR);
+G_DECLARE_FINAL_TYPE (LpPackFileInputStream, lp_pack_file_input_stream, LP, PACK_FILE_INPUT_STREAM, GFileInputStream);
+G_DEFINE_FINAL_TYPE (LpPackFileInputStream, lp_pack_file_input_stream, G_TYPE_FILE_INPUT_STREAM);
+
+/* readers exposed under LP_PACK_FILE_SCHEME, by name */
+static GMutex lock;
+static GHashTable* readers = NULL;
+
+static gchar* normalize (const gchar* path)
+{
+  const gsize size = strlen (path) + 1;
+  gchar* buffer = g_malloc (size);
+  const gchar* value = NULL;
+  guint32 hash;
+  gsize length;
+
+  /* normal forms never outgrow their paths, so this never fails */
+  if ((value = lp_path_normalize (path, buffer, size, &length, &hash)) != buffer)
+    memcpy (buffer, value, length + 1);
+return buffer;
+}
+
+static GFile* filenew (LpPackReader* reader, const gchar* name, gchar* path)
+{
+  LpPackFile* self = g_object_new (LP_TYPE_PACK_FILE, NULL);
+
+  self->reader = g_object_ref (reader);
+  self->name = g_strdup (name);
+  self->path = path;
+return G_FILE (self);
+}
+
+static gboolean samemount (LpPackFile* file_a, LpPackFile* file_b)
+{
+  return file_a->reader == file_b->reader && g_str_equal (file_a->name, file_b->name);
+}
+
+static GFile* lookupuri (GVfs* vfs, const char* identifier, gpointer user_data)
+{
+  LpPackReader* reader = NULL;
+  GFile* file = NULL;
+  gchar* scheme = NULL;
+  gchar* host = NULL;
+  gchar* path = NULL;
+
+  if (g_uri_split (identifier, G_URI_FLAGS_NONE, &scheme, NULL, &host, NULL, &path, NULL, NULL, NULL))
+    {
+      if (g_ascii_strcasecmp (scheme, LP_PACK_FILE_SCHEME) == 0 && host != NULL)
+        {
+          g_mutex_lock (&lock);
+
+          if (readers != NULL && (reader = g_hash_table_lookup (readers, host)) != NULL)
+            file = filenew (reader, host, normalize (path));
+
+          g_mutex_unlock (&lock);
+        }
+
+      g_free (scheme);
+      g_free (host);
+      g_free (path);
+    }
+return file;
+}
+
+static void lp_pack_file_class_finalize (GObject* pself)
+{
+  LpPackFile* self = (gpointer) pself;
+  g_object_unref (self->reader);
+  g_free (self->name);
+  g_free (self->path);
+  G_OBJECT_CLASS (lp_pack_file_parent_class)->finalize (pself);
+}
+
+static void lp_pack_file_class_init (LpPackFileClass* klass)
+{
+  G_OBJECT_CLASS (klass)->finalize = lp_pack_file_class_finalize;
+}
+
+static void lp_pack_file_init (LpPackFile* self)
+{
+}
+
+static GFile* lp_pack_file_g_file_iface_dup (GFile* pself)
+{
+  LpPackFile* self = (gpointer) pself;
+  return filenew (self->reader, self->name, g_strdup (self->path));
+}
+
+static guint lp_pack_file_g_file_iface_hash (GFile* pself)
+{
+  LpPackFile* self = (gpointer) pself;
+  return lp_path_hash (self->path, strlen (self->path)) ^ g_direct_hash (self->reader);
+}
+
+static gboolean lp_pack_file_g_file_iface_equal (GFile* pself, GFile* pother)
+{
+  LpPackFile* self = (gpointer) pself;
+  LpPackFile* other = (gpointer) pother;
+  return samemount (self, other) && g_str_equal (self->path, other->path);
+}
+
+static gboolean lp_pack_file_g_file_iface_is_native (GFile* pself)
+{
+  return FALSE;
+}
+
+static gboolean lp_pack_file_g_file_iface_has_uri_scheme (GFile* pself, const char* uri_scheme)
+{
+  return g_ascii_strcasecmp (uri_scheme, LP_PACK_FILE_SCHEME) == 0;
+}
+
+static char* lp_pack_file_g_file_iface_get_uri_scheme (GFile* pself)
+{
+  return g_strdup (LP_PACK_FILE_SCHEME);
+}
+
+static char* lp_pack_file_g_file_iface_get_basename (GFile* pself)
+{
+  LpPackFile* self = (gpointer) pself;
+  const gchar* slash = strrchr (self->path, '/');
+
+  if (self->path [0] == 0)
+    return g_strdup ("/");
+return g_strdup (slash == NULL ? self->path : slash + 1);
+}
+
+static char* lp_pack_file_g_file_iface_get_path (GFile* pself)
+{
+  return NULL;
+}
+
+static char* lp_pack_file_g_file_iface_get_uri (GFile* pself)
+{
+  LpPackFile* self = (gpointer) pself;
+  gchar* escaped = g_uri_escape_string (self->path, G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, FALSE);
+  gchar* uri = g_strconcat (LP_PACK_FILE_SCHEME "://", self->name, "/", escaped, NULL);
+return (g_free (escaped), uri);
+}
+
+static GFile* lp_pack_file_g_file_iface_get_parent (GFile* pself)
+{
+  LpPackFile* self = (gpointer) pself;
+  const gchar* slash = strrchr (self->path, '/');
+
+  if (self->path [0] == 0)
+    return NULL;
+return filenew (self->reader, self->name, slash == NULL ? g_strdup ("") : g_strndup (self->path, slash - self->path));
+}
+
+static gboolean lp_pack_file_g_file_iface_prefix_matches (GFile* pprefix, GFile* pself)
+{
+  LpPackFile* prefix = (gpointer) pprefix;
+  LpPackFile* self = (gpointer) pself;
+  const gsize length = strlen (prefix->path);
+
+  if (samemount (prefix, self) == FALSE || self->path [0] == 0)
+    return FALSE;
+  else if (length == 0)
+    return TRUE;
+return strncmp (self->path, prefix->path, length) == 0 && self->path [length] == '/';
+}
+
+static char* lp_pack_file_g_file_iface_get_relative_path (GFile* pparent, GFile* pdescendant)
+{
+  LpPackFile* parent = (gpointer) pparent;
+  LpPackFile* descendant = (gpointer) pdescendant;
+  const gsize length = strlen (parent->path);
+
+  if (lp_pack_file_g_file_iface_prefix_matches (pparent, pdescendant) == FALSE)
+    return NULL;
+return g_strdup (descendant->path + length + (length > 0));
+}
+
+static GFile* lp_pack_file_g_file_iface_resolve_relative_path (GFile* pself, const char* relative_path)
+{
+  LpPackFile* self = (gpointer) pself;
+  gchar* path = NULL;
+
+  if (g_path_is_absolute (relative_path))
+    path = normalize (relative_path);
+  else
+    {
+      gchar* joined = g_strconcat (self->path, "/", relative_path, NULL);
+
+      path = normalize (joined);
+      g_free (joined);
+    }
+return filenew (self->reader, self->name, path);
+}
+
+static GFile* lp_pack_file_g_file_iface_get_child_for_display_name (GFile* pself, const char* display_name, GError** error)
+{
+  return lp_pack_file_g_file_iface_resolve_relative_path (pself, display_name);
+}
+
+static GFileEnumerator* lp_pack_file_g_file_iface_enumerate_children (GFile* pself, const char* attributes, GFileQueryInfoFlags flags, GCancellable* cancellable, GError** error)
+{
+  LpPackFile* self = (gpointer) pself;
+  LpPackFileEnumerator* enumerator = NULL;
+  gchar** names = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+  if ((names = lp_pack_reader_enumerate_children (self->reader, self->path, error)) == NULL)
+    return NULL;
+
+  enumerator = g_object_new (lp_pack_file_enumerator_get_type (), "container", pself, NULL);
+  enumerator->attributes = g_strdup (attributes);
+  enumerator->names = names;
+return G_FILE_ENUMERATOR (enumerator);
+}
+
+static GFileInfo* lp_pack_file_g_file_iface_query_info (GFile* pself, const char* attributes, GFileQueryInfoFlags flags, GCancellable* cancellable, GError** error)
+{
+  LpPackFile* self = (gpointer) pself;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+return lp_pack_reader_query_info (self->reader, self->path, attributes, error);
+}
+
+static GFileInputStream* lp_pack_file_g_file_iface_read_fn (GFile* pself, GCancellable* cancellable, GError** error)
+{
+  LpPackFile* self = (gpointer) pself;
+  LpPackFileInputStream* stream = NULL;
+  GInputStream* base = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+  if ((base = lp_pack_reader_open (self->reader, self->path, error)) == NULL)
+    return NULL;
+
+  stream = g_object_new (lp_pack_file_input_stream_get_type (), NULL);
+  stream->base = base;
+  stream->file = g_object_ref (self);
+return G_FILE_INPUT_STREAM (stream);
+}
+
+static void lp_pack_file_g_file_iface_init (GFileIface* iface)
+{
+  iface->dup = lp_pack_file_g_file_iface_dup;
+  iface->hash = lp_pack_file_g_file_iface_hash;
+  iface->equal = lp_pack_file_g_file_iface_equal;
+  iface->is_native = lp_pack_file_g_file_iface_is_native;
+  iface->has_uri_scheme = lp_pack_file_g_file_iface_has_uri_scheme;
+  iface->get_uri_scheme = lp_pack_file_g_file_iface_get_uri_scheme;
+  iface->get_basename = lp_pack_file_g_file_iface_get_basename;
+  iface->get_path = lp_pack_file_g_file_iface_get_path;
+  iface->get_uri = lp_pack_file_g_file_iface_get_uri;
+  iface->get_parse_name = lp_pack_file_g_file_iface_get_uri;
+  iface->get_parent = lp_pack_file_g_file_iface_get_parent;
+  iface->prefix_matches = lp_pack_file_g_file_iface_prefix_matches;
+  iface->get_relative_path = lp_pack_file_g_file_iface_get_relative_path;
+  iface->resolve_relative_path = lp_pack_file_g_file_iface_resolve_relative_path;
+  iface->get_child_for_display_name = lp_pack_file_g_file_iface_get_child_for_display_name;
+  iface->enumerate_children = lp_pack_file_g_file_iface_enumerate_children;
+  iface->query_info = lp_pack_file_g_file_iface_query_info;
+  iface->read_fn = lp_pack_file_g_file_iface_read_fn;
+  iface->supports_thread_contexts = TRUE;
+}
+
+static GFileInfo* lp_pack_file_enumerator_class_next_file (GFileEnumerator* pself, GCancellable* cancellable, GError** error)
+{
+  LpPackFileEnumerator* self = (gpointer) pself;
+  LpPackFile* container = (gpointer) g_file_enumerator_get_container (pself);
+  GFileInfo* info = NULL;
+  const gchar* name = NULL;
+  gchar* path = NULL;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+  if ((name = self->names [self->next]) == NULL)
+    return NULL;
+
+  self->next++;
+  path = container->path [0] == 0 ? g_strdup (name) : g_strconcat (container->path, "/", name, NULL);
+  info = lp_pack_reader_query_info (container->reader, path, self->attributes, error);
+return (g_free (path), info);
+}
+
+static gboolean lp_pack_file_enumerator_class_close_fn (GFileEnumerator* pself, GCancellable* cancellable, GError** error)
+{
+  return TRUE;
+}
+
+static void lp_pack_file_enumerator_class_finalize (GObject* pself)
+{
+  LpPackFileEnumerator* self = (gpointer) pself;
+  g_free (self->attributes);
+  g_strfreev (self->names);
+  G_OBJECT_CLASS (lp_pack_file_enumerator_parent_class)->finalize (pself);
+}
+
+static void lp_pack_file_enumerator_class_init (LpPackFileEnumeratorClass* klass)
+{
+  G_FILE_ENUMERATOR_CLASS (klass)->next_file = lp_pack_file_enumerator_class_next_file;
+  G_FILE_ENUMERATOR_CLASS (klass)->close_fn = lp_pack_file_enumerator_class_close_fn;
+  G_OBJECT_CLASS (klass)->finalize = lp_pack_file_enumerator_class_finalize;
+}
+
+static void lp_pack_file_enumerator_init (LpPackFileEnumerator* self)
+{
+}
+
+static gssize lp_pack_file_input_stream_class_read_fn (GInputStream* pself, void* buffer, gsize count, GCancellable* cancellable, GError** error)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  return g_input_stream_read (self->base, buffer, count, cancellable, error);
+}
+
+static gssize lp_pack_file_input_stream_class_skip (GInputStream* pself, gsize count, GCancellable* cancellable, GError** error)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  return g_input_stream_skip (self->base, count, cancellable, error);
+}
+
+static gboolean lp_pack_file_input_stream_class_close_fn (GInputStream* pself, GCancellable* cancellable, GError** error)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  return g_input_stream_close (self->base, cancellable, error);
+}
+
+/* streams LpPackReader hands out are always seekable */
+static goffset lp_pack_file_input_stream_class_tell (GFileInputStream* pself)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  return g_seekable_tell (G_SEEKABLE (self->base));
+}
+
+static gboolean lp_pack_file_input_stream_class_can_seek (GFileInputStream* pself)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  return g_seekable_can_seek (G_SEEKABLE (self->base));
+}
+
+static gboolean lp_pack_file_input_stream_class_seek (GFileInputStream* pself, goffset offset, GSeekType type, GCancellable* cancellable, GError** error)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  return g_seekable_seek (G_SEEKABLE (self->base), offset, type, cancellable, error);
+}
+
+static GFileInfo* lp_pack_file_input_stream_class_query_info (GFileInputStream* pself, const char* attributes, GCancellable* cancellable, GError** error)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  return lp_pack_file_g_file_iface_query_info (G_FILE (self->file), attributes, 0, cancellable, error);
+}
+
+static void lp_pack_file_input_stream_class_finalize (GObject* pself)
+{
+  LpPackFileInputStream* self = (gpointer) pself;
+  g_object_unref (self->base);
+  g_object_unref (self->file);
+  G_OBJECT_CLASS (lp_pack_file_input_stream_parent_class)->finalize (pself);
+}
+
+static void lp_pack_file_input_stream_class_init (LpPackFileInputStreamClass* klass)
+{
+  G_FILE_INPUT_STREAM_CLASS (klass)->tell = lp_pack_file_input_stream_class_tell;
+  G_FILE_INPUT_STREAM_CLASS (klass)->can_seek = lp_pack_file_input_stream_class_can_seek;
+  G_FILE_INPUT_STREAM_CLASS (klass)->seek = lp_pack_file_input_stream_class_seek;
+  G_FILE_INPUT_STREAM_CLASS (klass)->query_info = lp_pack_file_input_stream_class_query_info;
+  G_INPUT_STREAM_CLASS (klass)->read_fn = lp_pack_file_input_stream_class_read_fn;
+  G_INPUT_STREAM_CLASS (klass)->skip = lp_pack_file_input_stream_class_skip;
+  G_INPUT_STREAM_CLASS (klass)->close_fn = lp_pack_file_input_stream_class_close_fn;
+  G_OBJECT_CLASS (klass)->finalize = lp_pack_file_input_stream_class_finalize;
+}
+
+static void lp_pack_file_input_stream_init (LpPackFileInputStream* self)
+{
+}
+
+/**
+ * lp_pack_file_get_reader:
+ * @file: #LpPackFile instance.
+ *
+ * Returns: (transfer none): the #LpPackReader @file reads from.
+*/
+LpPackReader* lp_pack_file_get_reader (LpPackFile* file)
+{
+  g_return_val_if_fail (LP_IS_PACK_FILE (file), NULL);
+return file->reader;
+}
+
+/**
+ * lp_pack_file_new: (constructor)
+ * @reader: #LpPackReader instance.
+ * @name: name @reader is (or would be) registered under.
+ * @path: path of a packed file or directory in @reader.
+ *
+ * Creates a #GFile for @path in @reader, whose URI is
+ * lpack://@name/@path. Reading or querying it goes straight
+ * to @reader index (and cache), nothing is extracted anywhere.
+ *
+ * Returns: (transfer full): a new #LpPackFile instance.
+*/
+GFile* lp_pack_file_new (LpPackReader* reader, const gchar* name, const gchar* path)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), NULL);
+  g_return_val_if_fail (name != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+return filenew (reader, name, normalize (path));
+}
+
+/**
+ * lp_pack_file_register:
+ * @name: name to expose @reader under.
+ * @reader: #LpPackReader instance.
+ *
+ * Exposes @reader contents under lpack://@name/, so
+ * #g_file_new_for_uri (and every GIO based consumer given
+ * such an URI) yields #LpPackFile instances reading from it.
+ * @name should be a valid URI host.
+*/
+void lp_pack_file_register (const gchar* name, LpPackReader* reader)
+{
+  g_return_if_fail (name != NULL);
+  g_return_if_fail (LP_IS_PACK_READER (reader));
+
+  g_mutex_lock (&lock);
+
+  if (G_UNLIKELY (readers == NULL))
+    {
+      readers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+      g_vfs_register_uri_scheme (g_vfs_get_default (), LP_PACK_FILE_SCHEME, lookupuri, NULL, NULL, lookupuri, NULL, NULL);
+    }
+
+  g_hash_table_insert (readers, g_strdup (name), g_object_ref (reader));
+  g_mutex_unlock (&lock);
+}
+
+/**
+ * lp_pack_file_unregister:
+ * @name: name passed to #lp_pack_file_register.
+ *
+ * Stops exposing the reader registered under @name. Files
+ * already created for it keep working.
+*/
+void lp_pack_file_unregister (const gchar* name)
+{
+  g_return_if_fail (name != NULL);
+
+  g_mutex_lock (&lock);
+
+  if (readers != NULL)
+    g_hash_table_remove (readers, name);
+
+  g_mutex_unlock (&lock);
+}
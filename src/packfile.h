@@ -0,0 +1,39 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LP_PACK_FILE__
+#define __LP_PACK_FILE__ 1
+#include <reader.h>
+
+#define LP_TYPE_PACK_FILE (lp_pack_file_get_type ())
+#define LP_PACK_FILE_SCHEME "lpack"
+
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  G_DECLARE_FINAL_TYPE (LpPackFile, lp_pack_file, LP, PACK_FILE, GObject);
+
+  LpPackReader* lp_pack_file_get_reader (LpPackFile* file);
+  GFile* lp_pack_file_new (LpPackReader* reader, const gchar* name, const gchar* path);
+  void lp_pack_file_register (const gchar* name, LpPackReader* reader);
+  void lp_pack_file_unregister (const gchar* name);
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
+#endif // __LP_PACK_FILE__
@@ -0,0 +1,70 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <format.h>
+#include <gvdb/gvdb-builder.h>
+#include <packindex.h>
+
+/**
+ * lp_pack_index_add:
+ * @entries: gvdb hash table to insert into.
+ * @ent: archive entry to index.
+ * @offset: offset of @ent header (see format.h).
+ *
+ * Inserts an index record describing @ent into @entries.
+*/
+void lp_pack_index_add (GHashTable* entries, struct archive_entry* ent, guint64 offset)
+{
+  const gchar* path = archive_entry_pathname (ent);
+  GvdbItem* item = gvdb_hash_table_insert (entries, path);
+  guint flags = 0;
+
+  if (archive_entry_atime_is_set (ent)) flags |= LP_PACK_INDEX_HAS_ATIME;
+  if (archive_entry_ctime_is_set (ent)) flags |= LP_PACK_INDEX_HAS_CTIME;
+  if (archive_entry_birthtime_is_set (ent)) flags |= LP_PACK_INDEX_HAS_BIRTHTIME;
+
+  gvdb_item_set_value (item, g_variant_new (LP_PACK_INDEX_ENTRY,
+                                            offset,
+                                            (guint64) archive_entry_size (ent),
+                                            (guint32) archive_entry_mode (ent),
+                                            flags,
+                                            (gint64) archive_entry_atime (ent), (guint32) archive_entry_atime_nsec (ent),
+                                            (gint64) archive_entry_ctime (ent), (guint32) archive_entry_ctime_nsec (ent),
+                                            (gint64) archive_entry_birthtime (ent), (guint32) archive_entry_birthtime_nsec (ent)));
+}
+
+/**
+ * lp_pack_index_new_root:
+ * @manifest: pack manifest.
+ * @layout: pack layout (a #LpPackLayout value).
+ * @entries: gvdb hash table filled by #lp_pack_index_add.
+ *
+ * Creates the root table of a pack index, ready to be passed
+ * to gvdb_table_serialize().
+ *
+ * Returns: (transfer full): a new gvdb hash table.
+*/
+GHashTable* lp_pack_index_new_root (GKeyFile* manifest, guint layout, GHashTable* entries)
+{
+  GHashTable* root = gvdb_hash_table_new (NULL, NULL);
+  gchar* data = g_key_file_to_data (manifest, NULL, NULL);
+
+  gvdb_hash_table_insert_string (root, LP_PACK_INDEX_MANIFEST, data);
+  gvdb_item_set_value (gvdb_hash_table_insert (root, LP_PACK_INDEX_LAYOUT), g_variant_new_uint32 (layout));
+  gvdb_item_set_hash_table (gvdb_hash_table_insert (root, LP_PACK_INDEX_ENTRIES), entries);
+return (g_free (data), root);
+}
@@ -0,0 +1,458 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <pathindex.h>
+#include <string.h>
+
+/*
+ * Paths are kept in an open addressing table with linear probing,
+ * whose slots carry the hash and length of their path (so most
+ * mismatches are rejected without touching the path itself). Paths
+ * are not copied, they are expected to live in an arena owned by
+ * whoever fills the index (see Source in readaux.h). Misses, the
+ * bulk of lookups when probing search paths, are mostly answered by
+ * a bloom filter (one word per four slots, two bits per path) without
+ * walking a probe sequence
+ */
+#define LP_PATH_INDEX_MIN_CAPACITY (16)
+#define LP_PATH_INDEX_SLOTS_PER_WORD (4)
+
+typedef struct _Slot Slot;
+
+struct _Slot
+{
+  guint32 hash;
+  guint32 length;
+  const gchar* name;
+  gpointer value;
+};
+
+struct _LpPathIndex
+{
+  Slot* slots;
+  guint32* bloom;
+  guint capacity;
+  guint size;
+};
+
+typedef struct _Hasher Hasher;
+
+/*
+ * Paths are hashed eight bytes (read as a little endian word) at a
+ * time, either straight from memory (lp_path_hash) or fed byte by
+ * byte while they are being checked (lp_path_normalize). Both ways
+ * yield the same value, as length is only mixed in at the end
+ */
+struct _Hasher
+{
+  guint64 hash;
+  guint64 word;
+  guint fill;
+};
+
+static inline guint64 mixword (guint64 hash, guint64 word)
+{
+  return (((hash << 5) | (hash >> 59)) ^ word) * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15);
+}
+
+static inline void hasher_feed (Hasher* hasher, guchar c)
+{
+  hasher->word |= (guint64) c << (hasher->fill << 3);
+
+  if (++hasher->fill == sizeof (hasher->word))
+    {
+      hasher->hash = mixword (hasher->hash, hasher->word);
+      hasher->word = 0;
+      hasher->fill = 0;
+    }
+}
+
+static inline guint32 hasher_finish (Hasher* hasher, gsize length)
+{
+  guint64 hash = hasher->hash;
+
+  if (hasher->fill > 0)
+    hash = mixword (hash, hasher->word);
+
+  hash = mixword (hash, length);
+return (guint32) (hash ^ (hash >> 32));
+}
+
+/**
+ * lp_path_hash:
+ * @path: path to hash.
+ * @length: length of @path in bytes.
+ *
+ * Hashes @path eight bytes at a time (instead of one, as
+ * #g_str_hash does).
+ *
+ * Returns: hash value for @path.
+*/
+guint32 lp_path_hash (const gchar* path, gsize length)
+{
+  Hasher hasher = {0};
+  const gsize total = length;
+  guint64 word;
+
+  for (; length >= sizeof (word); path += sizeof (word), length -= sizeof (word))
+    {
+      memcpy (&word, path, sizeof (word));
+      hasher.hash = mixword (hasher.hash, GUINT64_FROM_LE (word));
+    }
+
+  if (length > 0)
+    {
+      word = 0;
+      memcpy (&word, path, length);
+      hasher.word = GUINT64_FROM_LE (word);
+      hasher.fill = length;
+    }
+return hasher_finish (&hasher, total);
+}
+
+static inline gboolean isdots (const gchar* component, gsize length)
+{
+  return (length == 1 && component [0] == '.') || (length == 2 && component [0] == '.' && component [1] == '.');
+}
+
+/**
+ * lp_path_normalize:
+ * @path: path to normalize.
+ * @buffer: (out caller-allocates) (array length=size): where to write the normal form of @path.
+ * @size: size of @buffer in bytes.
+ * @length: (out): return location for the length of the normal form of @path.
+ * @hash: (out): return location for the #lp_path_hash value of the normal form of @path.
+ *
+ * Brings @path into the form paths are indexed with, the same
+ * #g_canonicalize_filename (relative to "/") followed by
+ * #g_path_skip_root would give: no leading or trailing separators,
+ * no empty, "." or ".." components. Paths which already are in
+ * such form (every path stored in a pack is) are only checked
+ * and hashed in a single pass, and returned as they are.
+ *
+ * Normal forms are never longer than the paths they come from,
+ * so @buffer never runs short if it can hold @path.
+ *
+ * Returns: (transfer none) (nullable): normal form of @path
+ * (either @path itself or @buffer), or %NULL if it does not
+ * fit into @buffer.
+*/
+const gchar* lp_path_normalize (const gchar* path, gchar* buffer, gsize size, gsize* length, guint32* hash)
+{
+  Hasher hasher = {0};
+  const gchar* component = NULL;
+  gsize i, start = 0, done = 0, n;
+
+  for (i = 0; path [i] != 0; ++i)
+    {
+      if (path [i] == '/')
+        {
+          if (i == start || isdots (path + start, i - start))
+            break;
+
+          start = i + 1;
+        }
+
+      hasher_feed (&hasher, path [i]);
+    }
+
+  if (path [i] == 0 && (i == 0 || (i > start && isdots (path + start, i - start) == FALSE)))
+    {
+      *length = i;
+      *hash = hasher_finish (&hasher, i);
+      return path;
+    }
+
+  for (component = path; *component != 0; component += n)
+    {
+      while (*component == '/')
+        ++component;
+
+      for (n = 0; component [n] != 0 && component [n] != '/'; ++n);
+
+      if (n == 0 || (n == 1 && component [0] == '.'))
+        continue;
+      else if (n == 2 && component [0] == '.' && component [1] == '.')
+        {
+          while (done > 0 && buffer [done - 1] != '/')
+            --done;
+          if (done > 0)
+            --done;
+        }
+      else
+        {
+          if (done + (done > 0) + n >= size)
+            return NULL;
+          if (done > 0)
+            buffer [done++] = '/';
+
+          memcpy (buffer + done, component, n);
+          done += n;
+        }
+    }
+
+  /* ".." may drop components already hashed, so hash once done */
+  buffer [done] = 0;
+  *length = done;
+  *hash = lp_path_hash (buffer, done);
+return buffer;
+}
+
+static inline guint32 bloombits (guint32 hash)
+{
+  return (1u << (hash & 31)) | (1u << (hash >> 27));
+}
+
+static inline guint32* bloomword (LpPathIndex* index, guint32 hash)
+{
+  return index->bloom + ((hash >> 5) & (index->capacity / LP_PATH_INDEX_SLOTS_PER_WORD - 1));
+}
+
+static Slot* probe (LpPathIndex* index, const gchar* path, gsize length, guint32 hash)
+{
+  const guint mask = index->capacity - 1;
+  Slot* slot = NULL;
+  guint i;
+
+  for (i = hash & mask;; i = (i + 1) & mask)
+    {
+      slot = index->slots + i;
+
+      if (slot->name == NULL)
+        break;
+      else if (slot->hash == hash && slot->length == length && memcmp (slot->name, path, length) == 0)
+        break;
+    }
+return slot;
+}
+
+static void reserve (LpPathIndex* index, guint count)
+{
+  Slot* slots = index->slots;
+  guint capacity = index->capacity;
+  guint i, j, mask;
+
+  /* tables are kept at most three quarters full */
+  if ((guint64) count * 4 <= (guint64) capacity * 3)
+    return;
+
+  index->capacity = MAX (capacity, LP_PATH_INDEX_MIN_CAPACITY);
+
+  while ((guint64) count * 4 > (guint64) index->capacity * 3)
+    index->capacity <<= 1;
+
+  g_free (index->bloom);
+  index->slots = g_new0 (Slot, index->capacity);
+  index->bloom = g_new0 (guint32, index->capacity / LP_PATH_INDEX_SLOTS_PER_WORD);
+  mask = index->capacity - 1;
+
+  for (i = 0; i < capacity; ++i)
+    {
+      if (slots [i].name == NULL)
+        continue;
+
+      for (j = slots [i].hash & mask; index->slots [j].name != NULL; j = (j + 1) & mask);
+      index->slots [j] = slots [i];
+      *bloomword (index, slots [i].hash) |= bloombits (slots [i].hash);
+    }
+
+  g_free (slots);
+}
+
+/**
+ * lp_path_index_new:
+ *
+ * Creates an empty path index.
+ *
+ * Returns: (transfer full): a new #LpPathIndex.
+*/
+LpPathIndex* lp_path_index_new (void)
+{
+  return g_slice_new0 (LpPathIndex);
+}
+
+/**
+ * lp_path_index_foreach:
+ * @index: #LpPathIndex instance.
+ * @func: (scope call) (closure user_data): function to call for each path.
+ * @user_data: (nullable): data to pass to @func.
+ *
+ * Calls @func for each path in @index, in no particular order.
+*/
+void lp_path_index_foreach (LpPathIndex* index, LpPathIndexFunc func, gpointer user_data)
+{
+  guint i;
+
+  for (i = 0; i < index->capacity; ++i)
+    if (index->slots [i].name != NULL)
+      func (index->slots [i].name, index->slots [i].value, user_data);
+}
+
+/**
+ * lp_path_index_free:
+ * @index: (transfer full): #LpPathIndex instance.
+ *
+ * Frees @index. Neither paths nor values are freed.
+*/
+void lp_path_index_free (LpPathIndex* index)
+{
+  g_free (index->bloom);
+  g_free (index->slots);
+  g_slice_free (LpPathIndex, index);
+}
+
+/**
+ * lp_path_index_get_size:
+ * @index: #LpPathIndex instance.
+ *
+ * Returns: number of paths in @index.
+*/
+guint lp_path_index_get_size (LpPathIndex* index)
+{
+  return index->size;
+}
+
+/**
+ * lp_path_index_insert:
+ * @index: #LpPathIndex instance.
+ * @path: (transfer none): path to insert, which must outlive @index.
+ * @length: length of @path in bytes.
+ * @hash: #lp_path_hash value for @path.
+ * @value: (transfer none): value to associate with @path.
+ *
+ * Inserts @path into @index, unless it is already there.
+ *
+ * Returns: %FALSE if @index already contained @path.
+*/
+gboolean lp_path_index_insert (LpPathIndex* index, const gchar* path, gsize length, guint32 hash, gpointer value)
+{
+  Slot* slot = NULL;
+
+  g_return_val_if_fail (length <= G_MAXUINT32, FALSE);
+  reserve (index, index->size + 1);
+
+  if ((slot = probe (index, path, length, hash))->name != NULL)
+    return FALSE;
+
+  slot->hash = hash;
+  slot->length = (guint32) length;
+  slot->name = path;
+  slot->value = value;
+  *bloomword (index, hash) |= bloombits (hash);
+return (++index->size, TRUE);
+}
+
+/**
+ * lp_path_index_lookup:
+ * @index: #LpPathIndex instance.
+ * @path: path to look up.
+ * @length: length of @path in bytes.
+ * @hash: #lp_path_hash value for @path.
+ * @key: (out) (optional): return location for the path stored in @index.
+ *
+ * Looks up @path in @index. Lookups do not modify @index, so
+ * they may run concurrently as long as nothing is inserted.
+ *
+ * Returns: (transfer none) (nullable): value associated with
+ * @path, or %NULL if @index does not contain it.
+*/
+gpointer lp_path_index_lookup (LpPathIndex* index, const gchar* path, gsize length, guint32 hash, const gchar** key)
+{
+  const guint32 bits = bloombits (hash);
+  Slot* slot = NULL;
+
+  if (index->capacity == 0 || (*bloomword (index, hash) & bits) != bits)
+    return NULL;
+  if ((slot = probe (index, path, length, hash))->name == NULL)
+    return NULL;
+  if (key != NULL)
+    *key = slot->name;
+return slot->value;
+}
+
+/**
+ * lp_path_index_merge:
+ * @index: #LpPathIndex instance.
+ * @other: #LpPathIndex to take paths from.
+ * @func: (nullable): resolves paths found in both indexes.
+ * @user_data: data passed to @func.
+ *
+ * Moves every path (and value) in @other into @index, growing the
+ * latter once for all of them. Paths are not copied, so they
+ * must outlive @index. If @func is %NULL and any path in @other is
+ * already in @index nothing is moved at all. Otherwise @func is
+ * called for every such path, and the value (and path) in @other
+ * replaces the one in @index only if it returns %TRUE.
+ *
+ * Returns: (nullable): the first path of @other found in @index
+ * (if @func is %NULL), or %NULL if every path was moved (leaving
+ * @other empty).
+*/
+const gchar* lp_path_index_merge (LpPathIndex* index, LpPathIndex* other, LpPathIndexMergeFunc func, gpointer user_data)
+{
+  Slot* slot = NULL;
+  Slot* from = NULL;
+  guint i;
+
+  for (i = 0; i < other->capacity && func == NULL; ++i)
+    {
+      from = other->slots + i;
+
+      if (from->name != NULL && lp_path_index_lookup (index, from->name, from->length, from->hash, NULL) != NULL)
+        return from->name;
+    }
+
+  reserve (index, index->size + other->size);
+
+  for (i = 0; i < other->capacity; ++i)
+    {
+      if ((from = other->slots + i)->name == NULL)
+        continue;
+
+      slot = probe (index, from->name, from->length, from->hash);
+
+      if (slot->name == NULL)
+        {
+          *bloomword (index, from->hash) |= bloombits (from->hash);
+          ++index->size;
+        }
+      else if (func (slot->name, slot->value, from->value, user_data) == FALSE)
+        continue;
+
+      slot->hash = from->hash;
+      slot->length = from->length;
+      slot->name = from->name;
+      slot->value = from->value;
+    }
+
+  lp_path_index_remove_all (other);
+return NULL;
+}
+
+/**
+ * lp_path_index_remove_all:
+ * @index: #LpPathIndex instance.
+ *
+ * Empties @index. Neither paths nor values are freed.
+*/
+void lp_path_index_remove_all (LpPathIndex* index)
+{
+  g_clear_pointer (&index->bloom, g_free);
+  g_clear_pointer (&index->slots, g_free);
+  index->capacity = 0;
+  index->size = 0;
+}
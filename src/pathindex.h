@@ -0,0 +1,44 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LP_PATH_INDEX__
+#define __LP_PATH_INDEX__ 1
+#include <glib.h>
+
+typedef struct _LpPathIndex LpPathIndex;
+typedef void (*LpPathIndexFunc) (const gchar* path, gpointer value, gpointer user_data);
+typedef gboolean (*LpPathIndexMergeFunc) (const gchar* path, gpointer current, gpointer value, gpointer user_data);
+
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  guint32 lp_path_hash (const gchar* path, gsize length);
+  const gchar* lp_path_normalize (const gchar* path, gchar* buffer, gsize size, gsize* length, guint32* hash);
+  LpPathIndex* lp_path_index_new (void);
+  void lp_path_index_foreach (LpPathIndex* index, LpPathIndexFunc func, gpointer user_data);
+  void lp_path_index_free (LpPathIndex* index);
+  guint lp_path_index_get_size (LpPathIndex* index);
+  gboolean lp_path_index_insert (LpPathIndex* index, const gchar* path, gsize length, guint32 hash, gpointer value);
+  gpointer lp_path_index_lookup (LpPathIndex* index, const gchar* path, gsize length, guint32 hash, const gchar** key);
+  const gchar* lp_path_index_merge (LpPathIndex* index, LpPathIndex* other, LpPathIndexMergeFunc func, gpointer user_data);
+  void lp_path_index_remove_all (LpPathIndex* index);
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
+#endif // __LP_PATH_INDEX__
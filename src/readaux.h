@@ -17,41 +17,75 @@
 #pragma once
 #include <archive.h>
 #include <archive_entry.h>
+#include <bufferpool.h>
+#include <builder.h>
 #include <format.h>
 #include <gio/gio.h>
 #include <reader.h>
+#include <xzindex.h>
 
 #define _g_key_file_free0(var) ((var == NULL) ? NULL : (var = (g_key_file_free (var), NULL)))
 
-#define source_blocked_bits (1)
+#define source_layout_bits (2)
 #define source_type_bites (2)
-#define source_refs_bits ((sizeof (guint) << 3) - (source_blocked_bits + source_type_bites))
+#define source_names_chunk (4096)
 
-typedef struct _File
-{
-  gchar* path;
-  guint hash;
-} File;
+typedef struct archive Archive;
+typedef struct archive_entry ArchiveEntry;
+typedef struct _Cursor Cursor;
+typedef struct _Entry Entry;
+typedef struct _Source Source;
+typedef struct _Times Times;
+typedef struct _Timespec Timespec;
 
 typedef struct _Reader
 {
-  gchar buffer [512];
+  gchar* buffer;
+  gsize buffer_size;
+  GCancellable* cancellable;
   GError* error;
+  GMutex* lock;
+  goffset length;
+  goffset origin;
+  goffset position;
+  gint spill;
 
   union
   {
     GFile* file;
     GInputStream* stream;
+    LpXzReader* xz;
   };
 } Reader;
 
-typedef struct _Source
+/*
+ * Sources are shared by every thread using a reader, so past
+ * scanning only refcount, cursor and (for stream sources) the
+ * stream position change, the last two guarded by lock.
+ * Sources own the entries found in them: paths live in names,
+ * records in entries (and their times, if any pack entry has
+ * them, at the same position in times) which is allocated once
+ * the pack was completely scanned and never moves afterwards
+ */
+struct _Source
 {
-  guint refcount : source_refs_bits;
-  guint blocked : source_blocked_bits;
+  gint refcount;
+  guint layout : source_layout_bits;
   guint type : source_type_bites;
 
+  GMutex lock;
+  GStringChunk* names;
+  Entry* entries;
+  Times* times;
+  guint n_entries;
+  gint layer;
+  Cursor* cursor;
+  GBytes* mapped;
+  GBytes* recoded;
   GKeyFile* manifest;
+  LpXzIndex* xzindex;
+  goffset length;
+  gsize buffer_size;
 
   union
   {
@@ -59,7 +93,52 @@ typedef struct _Source
     GFile* file;
     GInputStream* stream;
   };
-} Source;
+};
+
+struct _Timespec
+{
+  gint64 sec;
+  guint32 nsec;
+};
+
+/*
+ * Entry metadata is captured when the pack is scanned, so
+ * querying it needs no I/O. Times are kept apart (see Source),
+ * and only meaningful if their LP_PACK_INDEX_HAS_* bit is set
+ * in flags. Offsets and sizes (see entry_fits) share their words
+ * with mode and flags, so an entry takes three words
+ */
+#define entry_max ((G_GINT64_CONSTANT (1) << 47) - 1)
+
+struct _Entry
+{
+  Source* source;
+  gint64 offset : 48;
+  guint64 mode : 16;
+  gint64 size : 48;
+  guint64 flags : 16;
+};
+
+G_STATIC_ASSERT (sizeof (Entry) <= 3 * sizeof (guint64));
+
+struct _Times
+{
+  Timespec atime;
+  Timespec ctime;
+  Timespec btime;
+};
+
+/*
+ * An archive handle along with its callbacks state, and
+ * the offset (see format.h) of the entry header it last read
+ */
+struct _Cursor
+{
+  Archive* ar;
+  Reader reader;
+  goffset base;
+  goffset offset;
+};
 
 enum
 {
@@ -68,30 +147,48 @@ enum
   source_stream,
 };
 
-typedef struct archive Archive;
-typedef struct archive_entry ArchiveEntry;
+static int closepack (Archive* ar, Source* source, Reader* reader, GError** error);
 
-static int file_cmp (File* file_a, File* file_b)
+static Cursor* cursor_new (void)
 {
-  if (file_a->hash != file_b->hash)
-    return file_a->hash - file_b->hash;
-  else
-    return g_strcmp0 (file_a->path, file_b->path);
+  Cursor* cursor = g_slice_new0 (Cursor);
+  cursor->ar = archive_read_new ();
+  cursor->offset = -1;
+return cursor;
+}
+
+static void reader_clear (Reader* reader)
+{
+  lp_buffer_pool_release (reader->buffer, reader->buffer_size);
+  reader->buffer = NULL;
 }
 
-static void file_free (File* file)
+static void cursor_free (Cursor* cursor)
 {
-  g_free (file->path);
-  g_slice_free (File, file);
+  archive_read_free (cursor->ar);
+  reader_clear (&cursor->reader);
+  g_slice_free (Cursor, cursor);
 }
 
 static Source* source_new (guint type, gpointer arg)
 {
+  Source* source = NULL;
   Source template =
     {
       .refcount = 1,
+      .layout = LP_PACK_LAYOUT_SOLID,
       .type = type,
+      .names = g_string_chunk_new (source_names_chunk),
+      .entries = NULL,
+      .times = NULL,
+      .n_entries = 0,
+      .layer = 0,
+      .cursor = NULL,
+      .mapped = NULL,
       .manifest = NULL,
+      .xzindex = NULL,
+      .length = -1,
+      .buffer_size = LP_PACK_BUFFER_SIZE,
     };
 
   switch (type)
@@ -100,18 +197,24 @@ static Source* source_new (guint type, gpointer arg)
       case source_file: template.file = g_object_ref (arg); break;
       case source_stream: template.stream = g_object_ref (arg); break;
     }
-return g_slice_dup (Source, &template);
+return (source = g_slice_dup (Source, &template), g_mutex_init (&source->lock), source);
 }
 
 static Source* source_ref (Source* source)
 {
-  return (++source->refcount, source);
+  return (g_atomic_int_inc (&source->refcount), source);
 }
 
 static void source_unref (Source* source)
 {
-  if (--source->refcount == 0)
+  if (g_atomic_int_dec_and_test (&source->refcount))
     {
+      if (source->cursor != NULL)
+        {
+          closepack (source->cursor->ar, source, &source->cursor->reader, NULL);
+          cursor_free (source->cursor);
+        }
+
       switch (source->type)
         {
           case source_bytes: g_bytes_unref (source->bytes); break;
@@ -120,10 +223,102 @@ static void source_unref (Source* source)
         }
 
       _g_key_file_free0 (source->manifest);
+      g_clear_pointer (&source->names, g_string_chunk_free);
+      g_clear_pointer (&source->entries, g_free);
+      g_clear_pointer (&source->times, g_free);
+      g_clear_pointer (&source->mapped, g_bytes_unref);
+      g_clear_pointer (&source->recoded, g_bytes_unref);
+      g_clear_pointer (&source->xzindex, lp_xz_index_free);
+      g_mutex_clear (&source->lock);
       g_slice_free (Source, source);
     }
 }
 
+static GBytes* source_get_bytes (Source* source)
+{
+  switch (source->type)
+    {
+      case source_bytes: return source->bytes;
+      default: return source->mapped;
+    }
+}
+
+static void source_map (Source* source)
+{
+  GMappedFile* mapped = NULL;
+  gchar* path = NULL;
+
+  /*
+   * Local packs are mapped once and then read as memory,
+   * which spares a read syscall (and a copy) per 512 bytes
+   */
+  if (source->type == source_file && (path = g_file_get_path (source->file)) != NULL)
+    {
+      if ((mapped = g_mapped_file_new (path, FALSE, NULL)) != NULL)
+        {
+          source->mapped = g_mapped_file_get_bytes (mapped);
+          g_mapped_file_unref (mapped);
+        }
+
+      g_free (path);
+    }
+}
+
+/* entries live in their source, so holding one means holding its source */
+static Entry* entry_ref (Entry* entry)
+{
+  return (source_ref (entry->source), entry);
+}
+
+static void entry_unref (Entry* entry)
+{
+  source_unref (entry->source);
+}
+
+static const Times* entry_times (const Entry* entry)
+{
+  const Source* source = entry->source;
+  return source->times == NULL ? NULL : source->times + (entry - source->entries);
+}
+
+static gboolean entry_fits (goffset offset, goffset size)
+{
+  return offset >= 0 && offset <= entry_max && size <= entry_max;
+}
+
+static gboolean entry_stat (Entry* entry, Times* times, goffset offset, ArchiveEntry* ent)
+{
+  if (G_UNLIKELY (entry_fits (offset, archive_entry_size (ent)) == FALSE))
+    return FALSE;
+
+  entry->offset = offset;
+  entry->size = archive_entry_size_is_set (ent) ? archive_entry_size (ent) : -1;
+  entry->mode = archive_entry_mode (ent);
+  entry->flags = 0;
+
+  if (archive_entry_atime_is_set (ent))
+    {
+      entry->flags |= LP_PACK_INDEX_HAS_ATIME;
+      times->atime.sec = archive_entry_atime (ent);
+      times->atime.nsec = archive_entry_atime_nsec (ent);
+    }
+
+  if (archive_entry_ctime_is_set (ent))
+    {
+      entry->flags |= LP_PACK_INDEX_HAS_CTIME;
+      times->ctime.sec = archive_entry_ctime (ent);
+      times->ctime.nsec = archive_entry_ctime_nsec (ent);
+    }
+
+  if (archive_entry_birthtime_is_set (ent))
+    {
+      entry->flags |= LP_PACK_INDEX_HAS_BIRTHTIME;
+      times->btime.sec = archive_entry_birthtime (ent);
+      times->btime.nsec = archive_entry_birthtime_nsec (ent);
+    }
+return TRUE;
+}
+
 static int on_close (struct archive* ar, void* user_data)
 {
   GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Reader, error));
@@ -143,13 +338,20 @@ return (g_object_unref (stream), result);
 
 static int on_open (struct archive* ar, void* user_data)
 {
+  GCancellable* cancellable = G_STRUCT_MEMBER (GCancellable*, user_data, G_STRUCT_OFFSET (Reader, cancellable));
   GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Reader, error));
   GFile* file = G_STRUCT_MEMBER (GFile*, user_data, G_STRUCT_OFFSET (Reader, file));
+  goffset position = G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, position));
   GFileInputStream* stream = NULL;
   int result = ARCHIVE_OK;
 
-  if ((stream = g_file_read (file, NULL, error)), G_UNLIKELY (stream == NULL))
+  if ((stream = g_file_read (file, cancellable, error)), G_UNLIKELY (stream == NULL))
     result = ARCHIVE_FATAL;
+  else if (position > 0 && g_seekable_seek (G_SEEKABLE (stream), position, G_SEEK_SET, cancellable, error) == FALSE)
+    {
+      g_clear_object (&stream);
+      result = ARCHIVE_FATAL;
+    }
   G_STRUCT_MEMBER (gpointer, user_data, G_STRUCT_OFFSET (Reader, stream)) = stream;
 return (result);
 }
@@ -159,36 +361,148 @@ G_STATIC_ASSERT (sizeof (la_int64_t) == sizeof (gssize));
 
 static la_ssize_t on_read (struct archive* ar, void* user_data, const void** out_buffer)
 {
-  gchar* buffer = & G_STRUCT_MEMBER (gchar, user_data, G_STRUCT_OFFSET (Reader, buffer [0]));
+  gchar* buffer = G_STRUCT_MEMBER (gchar*, user_data, G_STRUCT_OFFSET (Reader, buffer));
+  GCancellable* cancellable = G_STRUCT_MEMBER (GCancellable*, user_data, G_STRUCT_OFFSET (Reader, cancellable));
   GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Reader, error));
   GInputStream* stream = G_STRUCT_MEMBER (GInputStream*, user_data, G_STRUCT_OFFSET (Reader, stream));
-  const gsize count = G_SIZEOF_MEMBER (Reader, buffer);
+  GMutex* lock = G_STRUCT_MEMBER (GMutex*, user_data, G_STRUCT_OFFSET (Reader, lock));
+  goffset length = G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, length));
+  goffset* position = & G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, position));
+  gsize count = G_STRUCT_MEMBER (gsize, user_data, G_STRUCT_OFFSET (Reader, buffer_size));
   gssize result = ARCHIVE_OK;
 
-  if ((result = g_input_stream_read (stream, buffer, count, NULL, error)), G_UNLIKELY (result < 0))
+  if (length >= 0)
+    count = MIN (count, (gsize) (length - *position));
+
+  /*
+   * A shared stream is read positionally, that is seeked to
+   * this reader position first while holding the source lock
+   */
+  if (lock != NULL)
+    g_mutex_lock (lock);
+  if (lock != NULL && g_seekable_seek (G_SEEKABLE (stream), *position, G_SEEK_SET, cancellable, error) == FALSE)
+    result = (gssize) ARCHIVE_FATAL;
+  else if ((result = g_input_stream_read (stream, buffer, count, cancellable, error)), G_UNLIKELY (result < 0))
     result = (gssize) ARCHIVE_FATAL;
+  else
+    *position += result;
+  if (lock != NULL)
+    g_mutex_unlock (lock);
 return (*out_buffer = buffer, result);
 }
 
 static la_int64_t on_skip (struct archive* ar, void* user_data, la_int64_t request)
 {
+  GCancellable* cancellable = G_STRUCT_MEMBER (GCancellable*, user_data, G_STRUCT_OFFSET (Reader, cancellable));
   GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Reader, error));
   GInputStream* stream = G_STRUCT_MEMBER (GInputStream*, user_data, G_STRUCT_OFFSET (Reader, stream));
+  GMutex* lock = G_STRUCT_MEMBER (GMutex*, user_data, G_STRUCT_OFFSET (Reader, lock));
+  goffset length = G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, length));
+  goffset* position = & G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, position));
   gssize result = ARCHIVE_OK;
 
-  if ((result = g_input_stream_skip (stream, request, NULL, error)), G_UNLIKELY (result < 0))
+  if (length >= 0)
+    request = MIN (request, length - *position);
+
+  /* positional reads seek anyway, so skipping is just bookkeeping */
+  if (lock != NULL)
+    return (*position += request, request);
+
+  /*
+   * Seeking is O(1), while skipping may well read and discard
+   * (whatever the stream implementation chooses to do)
+   */
+  if (G_IS_SEEKABLE (stream) && g_seekable_can_seek (G_SEEKABLE (stream)))
+    {
+      if (G_UNLIKELY (g_seekable_seek (G_SEEKABLE (stream), request, G_SEEK_CUR, cancellable, error) == FALSE))
+        return ARCHIVE_FATAL;
+      return (*position += request, request);
+    }
+
+  if ((result = g_input_stream_skip (stream, request, cancellable, error)), G_UNLIKELY (result < 0))
     result = ARCHIVE_FATAL;
+  else
+    *position += result;
 return (result);
 }
 
-#define report(error, funcname, ar, reader) \
+static la_int64_t on_seek (struct archive* ar, void* user_data, la_int64_t offset, int whence)
+{
+  GCancellable* cancellable = G_STRUCT_MEMBER (GCancellable*, user_data, G_STRUCT_OFFSET (Reader, cancellable));
+  GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Reader, error));
+  GInputStream* stream = G_STRUCT_MEMBER (GInputStream*, user_data, G_STRUCT_OFFSET (Reader, stream));
+  GMutex* lock = G_STRUCT_MEMBER (GMutex*, user_data, G_STRUCT_OFFSET (Reader, lock));
+  goffset length = G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, length));
+  goffset origin = G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, origin));
+  goffset* position = & G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, position));
+  goffset target = -1;
+
+  /*
+   * libarchive offsets are relative to where the pack was opened
+   * at (origin), while @stream ones are relative to the pack start
+   */
+  switch (whence)
+    {
+      case SEEK_SET: target = origin + offset; break;
+      case SEEK_CUR: target = *position + offset; break;
+      case SEEK_END:
+        {
+          if (length >= 0)
+            target = length + offset;
+          else
+            {
+              if (lock != NULL)
+                g_mutex_lock (lock);
+              if (g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_END, cancellable, error))
+                target = g_seekable_tell (G_SEEKABLE (stream)) + offset;
+              if (lock != NULL)
+                g_mutex_unlock (lock);
+              if (G_UNLIKELY (target < 0))
+                return ARCHIVE_FATAL;
+            }
+          break;
+        }
+      default: return ARCHIVE_FATAL;
+    }
+
+  if (G_UNLIKELY (target < origin))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "seek before pack start");
+      return ARCHIVE_FATAL;
+    }
+  else if (lock == NULL && g_seekable_seek (G_SEEKABLE (stream), target, G_SEEK_SET, cancellable, error) == FALSE)
+    return ARCHIVE_FATAL;
+return (*position = target) - origin;
+}
+
+static la_ssize_t on_xzread (struct archive* ar, void* user_data, const void** out_buffer)
+{
+  gchar* buffer = G_STRUCT_MEMBER (gchar*, user_data, G_STRUCT_OFFSET (Reader, buffer));
+  gsize count = G_STRUCT_MEMBER (gsize, user_data, G_STRUCT_OFFSET (Reader, buffer_size));
+  GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Reader, error));
+  LpXzReader* xz = G_STRUCT_MEMBER (LpXzReader*, user_data, G_STRUCT_OFFSET (Reader, xz));
+  gssize result = ARCHIVE_OK;
+
+  if ((result = lp_xz_reader_read (xz, buffer, count, error)), G_UNLIKELY (result < 0))
+    result = (gssize) ARCHIVE_FATAL;
+return (*out_buffer = buffer, result);
+}
+
+static int on_xzclose (struct archive* ar, void* user_data)
+{
+  LpXzReader** xz = & G_STRUCT_MEMBER (LpXzReader*, user_data, G_STRUCT_OFFSET (Reader, xz));
+  g_clear_pointer (xz, lp_xz_reader_free);
+return ARCHIVE_OK;
+}
+
+#define report(errorp, funcname, ar, reader) \
   G_STMT_START { \
     Archive* __archive = (ar); \
-    GError** __error = (error); \
+    GError** __error = (errorp); \
     Reader* __reader = (reader); \
  ; \
     if (G_LIKELY (__reader->error != NULL)) \
-      g_propagate_error (error, __reader->error); \
+      g_propagate_error (__error, g_steal_pointer (&__reader->error)); \
     else \
       { \
         const GQuark __domain = LP_PACK_READER_ERROR; \
@@ -204,63 +518,174 @@ static int closepack (Archive* ar, Source* source, Reader* reader, GError** erro
   int result;
   if ((result = archive_read_close (ar)), G_UNLIKELY (result != ARCHIVE_OK))
     report (error, archive_read_close, ar, reader);
-return (source->blocked = FALSE, result);
+return result;
+}
+
+static gboolean parkcursor (Source* source, Cursor* cursor, GError** error)
+{
+  int result = ARCHIVE_OK;
+
+  /*
+   * Keep @cursor around so a later lookup of an entry ahead
+   * of it continues decompressing from there instead of
+   * starting over (only worth it for solid packs)
+   */
+  if (source->layout == LP_PACK_LAYOUT_SOLID)
+    {
+      g_mutex_lock (&source->lock);
+
+      if (source->cursor == NULL)
+        source->cursor = g_steal_pointer (&cursor);
+
+      g_mutex_unlock (&source->lock);
+    }
+
+  if (cursor != NULL)
+    {
+      result = closepack (cursor->ar, source, &cursor->reader, error);
+      cursor_free (cursor);
+    }
+return result == ARCHIVE_OK;
 }
 
-static int openpack (Archive* ar, Source* source, Reader* reader, GError** error)
+static int setformat (Archive* ar, Source* source, GError** error)
 {
   int result = ARCHIVE_OK;
 
-  if ((result = archive_read_append_filter (ar, LP_PACK_COMPRESSION)), G_UNLIKELY (result != ARCHIVE_OK))
-    g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "archive_read_append_filter()!: %s", archive_error_string (ar));
-  else if ((result = archive_read_set_format (ar, LP_PACK_FORMAT)), G_UNLIKELY (result != ARCHIVE_OK))
-    g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "archive_read_set_format()!: %s", archive_error_string (ar));
+  switch (source->layout)
+    {
+      case LP_PACK_LAYOUT_SOLID:
+        if ((result = archive_read_append_filter (ar, LP_PACK_COMPRESSION)), G_UNLIKELY (result != ARCHIVE_OK))
+          g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "archive_read_append_filter()!: %s", archive_error_string (ar));
+        else if ((result = archive_read_set_format (ar, LP_PACK_FORMAT)), G_UNLIKELY (result != ARCHIVE_OK))
+          g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "archive_read_set_format()!: %s", archive_error_string (ar));
+        break;
+
+      case LP_PACK_LAYOUT_RANDOM:
+      case LP_PACK_LAYOUT_STORED:
+
+        /*
+         * Random access packs are read starting from the entry
+         * local header, so the central directory can not be used
+         * (its offsets are relative to the start of the pack)
+         */
+        if ((result = archive_read_support_format_zip_streamable (ar)), G_UNLIKELY (result != ARCHIVE_OK))
+          g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "archive_read_support_format_zip_streamable()!: %s", archive_error_string (ar));
+        break;
+
+      default:
+        result = ARCHIVE_FATAL;
+        g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "unknown pack layout %u", (guint) source->layout);
+        break;
+    }
+return result;
+}
+
+static GInputStream* sourcestream (Source* source, GError** error)
+{
+  GInputStream* stream = NULL;
+  GBytes* bytes = source_get_bytes (source);
+
+  switch (bytes != NULL ? source_bytes : source->type)
+    {
+      case source_bytes: stream = g_memory_input_stream_new_from_bytes (bytes); break;
+      case source_file: stream = (GInputStream*) g_file_read (source->file, NULL, error); break;
+      case source_stream: stream = g_object_ref (source->stream); break;
+    }
+return stream;
+}
+
+static GInputStream* xzstream (Source* source, GError** error)
+{
+  /* single block packs are decoded from their recoded copy, if any */
+  if (source->recoded != NULL)
+    return g_memory_input_stream_new_from_bytes (source->recoded);
+return sourcestream (source, error);
+}
+
+static void readerbuffer (Reader* reader, Source* source)
+{
+  /* buffers live as long as @reader, so reused cursors keep theirs */
+  if (reader->buffer == NULL)
+    reader->buffer = lp_buffer_pool_acquire (reader->buffer_size = source->buffer_size);
+}
+
+static int openxz (Archive* ar, Source* source, Reader* reader, goffset offset, GError** error)
+{
+  GInputStream* stream = NULL;
+  int result = ARCHIVE_OK;
+
+  if ((result = archive_read_set_format (ar, LP_PACK_FORMAT)), G_UNLIKELY (result != ARCHIVE_OK))
+    {
+      g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "archive_read_set_format()!: %s", archive_error_string (ar));
+      return result;
+    }
+  else if ((stream = xzstream (source, error)), G_UNLIKELY (stream == NULL))
+    return ARCHIVE_FATAL;
+  else if ((reader->xz = lp_xz_reader_new (source->xzindex, stream, source->type == source_stream ? &source->lock : NULL, offset, source->buffer_size, error), g_object_unref (stream)), G_UNLIKELY (reader->xz == NULL))
+    return ARCHIVE_FATAL;
+  else if ((readerbuffer (reader, source), result = archive_read_open2 (ar, reader, NULL, on_xzread, NULL, on_xzclose)), G_UNLIKELY (result != ARCHIVE_OK))
+    {
+      result = ARCHIVE_FATAL;
+
+      report (error, archive_read_open2, ar, reader);
+    }
+return result;
+}
+
+static int openpack (Archive* ar, Source* source, Reader* reader, goffset offset, GError** error)
+{
+  int result = ARCHIVE_OK;
+
+  /*
+   * A solid pack whose xz stream has a block index can
+   * be decoded starting at the block holding @offset
+   */
+  if (source->layout == LP_PACK_LAYOUT_SOLID && source->xzindex != NULL && offset > 0)
+    return openxz (ar, source, reader, offset, error);
+
+  if ((result = setformat (ar, source, error)), G_UNLIKELY (result != ARCHIVE_OK))
+    return result;
   else
     {
-      switch (source->type)
+      GBytes* bytes = source_get_bytes (source);
+
+      reader->length = source->length;
+      reader->origin = offset;
+      reader->position = offset;
+
+      switch (bytes != NULL ? source_bytes : source->type)
         {
           case source_bytes:
             {
               gsize size;
               gconstpointer data;
 
-              data = g_bytes_get_data (source->bytes, &size);
-              result = archive_read_open_memory (ar, data, size);
+              data = g_bytes_get_data (bytes, &size);
+              size = source->length < 0 ? size : MIN (size, (gsize) source->length);
+              result = archive_read_open_memory (ar, ((const gchar*) data) + offset, size - offset);
               break;
             }
 
           case source_file:
+            readerbuffer (reader, source);
             reader->file = source->file;
+            archive_read_set_seek_callback (ar, on_seek);
             result = archive_read_open2 (ar, reader, on_open, on_read, on_skip, on_close);
             break;
 
           case source_stream:
-            {
-              if (source->blocked == FALSE)
-                source->blocked = TRUE;
-              else
-                {
-                  const GQuark domain = LP_PACK_READER_ERROR;
-                  const guint code = LP_PACK_READER_ERROR_OPEN;
-                  const gchar* message = "pack source is blocked";
-
-                  g_set_error_literal (error, domain, code, message);
-                  return ARCHIVE_FATAL;
-                }
-
-              if ((result = g_seekable_seek (G_SEEKABLE (source->stream), 0, G_SEEK_SET, NULL, error)), G_UNLIKELY (result == FALSE))
-                return ARCHIVE_FATAL;
-
-              reader->stream = source->stream;
-              result = archive_read_open2 (ar, reader, NULL, on_read, on_skip, NULL);
-              break;
-            }
+            readerbuffer (reader, source);
+            reader->lock = &source->lock;
+            reader->stream = source->stream;
+            archive_read_set_seek_callback (ar, on_seek);
+            result = archive_read_open2 (ar, reader, NULL, on_read, on_skip, NULL);
+            break;
         }
 
       if (G_UNLIKELY (result != ARCHIVE_OK))
         {
           result = ARCHIVE_FATAL;
-          source->blocked = FALSE;
 
           report (error, archive_read_open*, ar, reader);
         }
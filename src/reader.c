@@ -15,16 +15,88 @@
  * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
  */
 #include <config.h>
+#include <anonfile.h>
+#include <gvdb/gvdb-builder.h>
+#include <gvdb/gvdb-reader.h>
+#include <packindex.h>
+#include <pathindex.h>
 #include <readaux.h>
+#include <errno.h>
+#include <glib/gstdio.h>
 
 #define _g_object_unref0(var) ((var == NULL) ? NULL : (var = (g_object_unref (var), NULL)))
+#define key_buffer_size (256)
+
+typedef struct _BatchItem BatchItem;
+typedef struct _CacheItem CacheItem;
+typedef struct _Child Child;
+typedef struct _Dir Dir;
+typedef struct _Key Key;
+typedef struct _ReadySource ReadySource;
+typedef struct _ScanJob ScanJob;
+typedef struct _Sidecar Sidecar;
+typedef struct _Staged Staged;
+typedef struct _Stamp Stamp;
 
 struct _LpPackReader
 {
   GObject parent;
 
   /* <private> */
-  GTree* vfs;
+  LpPathIndex* vfs;
+  LpPathIndex* dirs;
+  GPtrArray* sources;
+  GRWLock lock;
+
+  GHashTable* cache;
+  GMutex cache_lock;
+  GQueue lru;
+  guint64 cache_budget;
+  guint64 cache_hits;
+  guint64 cache_misses;
+  guint64 cache_size;
+
+  /* guarded by cache_lock as well */
+  guint buffer_size;
+  gint layer;
+  guint read_ahead;
+  guint64 recode_limit;
+  GThreadPool* sidecars;
+  GCancellable* sidecars_cancellable;
+};
+
+/*
+ * Directories are not (necessarily) packed, so they are inferred
+ * from entry paths when a pack is merged. Each one lists its
+ * children sorted (pointing to their own listing, if any), and
+ * is keyed (in LpPackReader::dirs) by a prefix of the path of
+ * some entry under it, so neither keys nor children paths are
+ * copied (nor NUL terminated)
+ */
+struct _Child
+{
+  const gchar* path;
+  gsize length;
+  Dir* dir;
+};
+
+struct _Dir
+{
+  GArray* children;
+  gboolean dirty;
+};
+
+/*
+ * A path being looked up, in normal form (see lp_path_normalize)
+ * and kept on the stack unless it is too long for buffer
+ */
+struct _Key
+{
+  const gchar* path;
+  gsize length;
+  guint32 hash;
+  gchar* heap;
+  gchar buffer [key_buffer_size];
 };
 
 struct _LpPackReaderStream
@@ -32,221 +104,2413 @@ struct _LpPackReaderStream
   GInputStream parent;
 
   /* <private> */
-  Archive* ar;
-  Reader reader;
+  Cursor* cursor;
+  Entry* entry;
+  gchar* path;
+
+  const gchar* block;
+  gsize left;
+  goffset position;
+
+  LpXzReader* xz;
+  gchar* buffer;
+  gsize buffer_size;
+  goffset data;
+
+  GThread* worker;
+  GMutex lock;
+  GCond cond;
+  GQueue chunks;
+  GSList* sources;
+  GError* error;
+  gsize consumed;
+  guint depth;
+  guint done : 1;
+  guint stop : 1;
+};
+
+struct _BatchItem
+{
+  const gchar* path;
+  Entry* entry;
+};
+
+struct _CacheItem
+{
+  GList link;
+  Entry* entry;
+  GBytes* bytes;
+};
+
+/*
+ * Entries found while scanning a pack, in pack order. Records
+ * are handed over to their source (see readaux.h) once the
+ * whole pack was scanned, paths already live there
+ */
+struct _Staged
+{
+  GArray* entries;
+  GArray* times;
+  GPtrArray* paths;
+  gboolean timed;
+  Sidecar* sidecar;
+};
+
+/*
+ * A pack being scanned by a worker thread (see
+ * lp_pack_reader_add_from_files), merged by the calling one
+ */
+struct _ScanJob
+{
+  Source* source;
+  LpPathIndex* index;
+  Staged staged;
+  GError* error;
+  gboolean good;
+};
+
+struct _Stamp
+{
+  guint64 size;
+  guint64 mtime;
+  gchar* digest;
+};
+
+/*
+ * A cache (see walksource) to be written once its pack is merged,
+ * which is done by LpPackReader::sidecars off the scanning thread
+ */
+struct _Sidecar
+{
   Source* source;
+  GHashTable* entries;
+  GCancellable* cancellable;
+  gchar* path;
+  gboolean recode;
+  Stamp stamp;
+};
+
+enum
+{
+  prop_0,
+  prop_buffer_size,
+  prop_cache_budget,
+  prop_cache_hits,
+  prop_cache_misses,
+  prop_layer,
+  prop_read_ahead,
+  prop_recode_limit,
+  prop_number,
 };
 
 G_DEFINE_QUARK (lp-pack-reader-error-quark, lp_pack_reader_error);
 G_DEFINE_FINAL_TYPE (LpPackReader, lp_pack_reader, G_TYPE_OBJECT);
 G_DECLARE_FINAL_TYPE (LpPackReaderStream, lp_pack_reader_stream, LP, PACK_READER_STREAM, GInputStream);
-G_DEFINE_FINAL_TYPE (LpPackReaderStream, lp_pack_reader_stream, G_TYPE_INPUT_STREAM);
+static void lp_pack_reader_stream_g_pollable_input_stream_iface_init (GPollableInputStreamInterface* iface);
+static void lp_pack_reader_stream_g_seekable_iface_init (GSeekableIface* iface);
+G_DEFINE_FINAL_TYPE_WITH_CODE (LpPackReaderStream, lp_pack_reader_stream, G_TYPE_INPUT_STREAM,
+  G_IMPLEMENT_INTERFACE (G_TYPE_POLLABLE_INPUT_STREAM, lp_pack_reader_stream_g_pollable_input_stream_iface_init)
+  G_IMPLEMENT_INTERFACE (G_TYPE_SEEKABLE, lp_pack_reader_stream_g_seekable_iface_init));
+
+struct _ReadySource
+{
+  GSource parent;
+  LpPackReaderStream* stream;
+};
+
+static GParamSpec* properties [prop_number] = {0};
+static Cursor* opencursor (Entry* entry, const gchar* path, ArchiveEntry** ent, GCancellable* cancellable, GError** error);
+static void writesidecar (Sidecar* sidecar, gpointer user_data);
+
+static void cacheitem_free (CacheItem* item)
+{
+  g_bytes_unref (item->bytes);
+  g_slice_free (CacheItem, item);
+}
+
+static Sidecar* sidecar_new (Source* source, gchar* path, Stamp* stamp, GHashTable* entries)
+{
+  Sidecar* sidecar = g_slice_new (Sidecar);
+
+  sidecar->source = source_ref (source);
+  sidecar->entries = entries;
+  sidecar->cancellable = NULL;
+  sidecar->path = path;
+  sidecar->recode = FALSE;
+  sidecar->stamp = *stamp;
+  stamp->digest = NULL;
+return sidecar;
+}
+
+static void sidecar_free (Sidecar* sidecar)
+{
+  source_unref (sidecar->source);
+  g_hash_table_unref (sidecar->entries);
+  _g_object_unref0 (sidecar->cancellable);
+  g_free (sidecar->path);
+  g_free (sidecar->stamp.digest);
+  g_slice_free (Sidecar, sidecar);
+}
+
+static void cacheevict (LpPackReader* self)
+{
+  GList* link = NULL;
+
+  while (self->cache_size > self->cache_budget && (link = g_queue_pop_tail_link (&self->lru)) != NULL)
+    {
+      CacheItem* item = link->data;
+
+      self->cache_size -= g_bytes_get_size (item->bytes);
+      g_hash_table_remove (self->cache, item->entry);
+    }
+}
+
+static GBytes* cachelookup (LpPackReader* self, Entry* entry)
+{
+  CacheItem* item = NULL;
+  GBytes* bytes = NULL;
+
+  g_mutex_lock (&self->cache_lock);
+
+  if ((item = g_hash_table_lookup (self->cache, entry)) == NULL)
+    ++self->cache_misses;
+  else
+    {
+      g_queue_unlink (&self->lru, &item->link);
+      g_queue_push_head_link (&self->lru, &item->link);
+      bytes = g_bytes_ref (item->bytes);
+      ++self->cache_hits;
+    }
+
+  g_mutex_unlock (&self->cache_lock);
+return bytes;
+}
+
+static void cacheinsert (LpPackReader* self, Entry* entry, GBytes* bytes)
+{
+  CacheItem* item = g_slice_new0 (CacheItem);
+
+  item->link.data = item;
+  item->entry = entry;
+  item->bytes = g_bytes_ref (bytes);
+
+  g_mutex_lock (&self->cache_lock);
+
+  /* another thread may have raced us into decompressing @entry */
+  if (g_hash_table_contains (self->cache, entry))
+    cacheitem_free (item);
+  else
+    {
+      g_hash_table_insert (self->cache, entry, item);
+      g_queue_push_head_link (&self->lru, &item->link);
+
+      self->cache_size += g_bytes_get_size (bytes);
+      cacheevict (self);
+    }
+
+  g_mutex_unlock (&self->cache_lock);
+}
+
+static Dir* dir_new (void)
+{
+  Dir* dir = g_slice_new0 (Dir);
+  return (dir->children = g_array_new (FALSE, FALSE, sizeof (Child)), dir);
+}
+
+static void dir_free (const gchar* path, gpointer dir, gpointer user_data)
+{
+  g_array_unref (((Dir*) dir)->children);
+  g_slice_free (Dir, dir);
+}
 
 static void lp_pack_reader_init (LpPackReader* self)
 {
-  const GCompareDataFunc func1 = (GCompareDataFunc) file_cmp;
-  const GDestroyNotify func2 = (GDestroyNotify) file_free;
-  const GDestroyNotify func3 = (GDestroyNotify) source_unref;
+  const GDestroyNotify func1 = (GDestroyNotify) source_unref;
+  const GDestroyNotify func2 = (GDestroyNotify) cacheitem_free;
 
-  self->vfs = g_tree_new_full (func1, NULL, func2, func3);
+  self->vfs = lp_path_index_new ();
+  self->dirs = lp_path_index_new ();
+  lp_path_index_insert (self->dirs, "", 0, lp_path_hash ("", 0), dir_new ());
+  self->sources = g_ptr_array_new_with_free_func (func1);
+  self->cache = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, func2);
+  self->sidecars = g_thread_pool_new ((GFunc) writesidecar, NULL, 1, FALSE, NULL);
+  self->sidecars_cancellable = g_cancellable_new ();
+  g_queue_init (&self->lru);
+  g_mutex_init (&self->cache_lock);
+  g_rw_lock_init (&self->lock);
 }
 
 static void lp_pack_reader_class_dispose (GObject* pself)
 {
   LpPackReader* self = (gpointer) pself;
-  g_tree_remove_all (self->vfs);
+  /* pending caches are still written, but nothing is recoded */
+  g_cancellable_cancel (self->sidecars_cancellable);
+  g_hash_table_remove_all (self->cache);
+  g_queue_init (&self->lru);
+  self->cache_size = 0;
+  lp_path_index_foreach (self->dirs, dir_free, NULL);
+  lp_path_index_remove_all (self->dirs);
+  lp_path_index_remove_all (self->vfs);
+  g_ptr_array_set_size (self->sources, 0);
   G_OBJECT_CLASS (lp_pack_reader_parent_class)->dispose (pself);
 }
 
 static void lp_pack_reader_class_finalize (GObject* pself)
 {
   LpPackReader* self = (gpointer) pself;
-  g_tree_unref (self->vfs);
+  g_thread_pool_free (self->sidecars, FALSE, TRUE);
+  g_object_unref (self->sidecars_cancellable);
+  g_hash_table_unref (self->cache);
+  g_mutex_clear (&self->cache_lock);
+  lp_path_index_free (self->dirs);
+  lp_path_index_free (self->vfs);
+  g_ptr_array_unref (self->sources);
+  g_rw_lock_clear (&self->lock);
   G_OBJECT_CLASS (lp_pack_reader_parent_class)->finalize (pself);
 }
 
+static void lp_pack_reader_class_get_property (GObject* pself, guint property_id, GValue* value, GParamSpec* pspec)
+{
+  LpPackReader* self = (gpointer) pself;
+
+  g_mutex_lock (&self->cache_lock);
+
+  switch (property_id)
+    {
+      default: G_OBJECT_WARN_INVALID_PROPERTY_ID (pself, property_id, pspec); break;
+      case prop_buffer_size: g_value_set_uint (value, self->buffer_size); break;
+      case prop_cache_budget: g_value_set_uint64 (value, self->cache_budget); break;
+      case prop_cache_hits: g_value_set_uint64 (value, self->cache_hits); break;
+      case prop_cache_misses: g_value_set_uint64 (value, self->cache_misses); break;
+      case prop_layer: g_value_set_int (value, self->layer); break;
+      case prop_read_ahead: g_value_set_uint (value, self->read_ahead); break;
+      case prop_recode_limit: g_value_set_uint64 (value, self->recode_limit); break;
+    }
+
+  g_mutex_unlock (&self->cache_lock);
+}
+
+static void lp_pack_reader_class_set_property (GObject* pself, guint property_id, const GValue* value, GParamSpec* pspec)
+{
+  LpPackReader* self = (gpointer) pself;
+
+  g_mutex_lock (&self->cache_lock);
+
+  switch (property_id)
+    {
+      default: G_OBJECT_WARN_INVALID_PROPERTY_ID (pself, property_id, pspec); break;
+      case prop_buffer_size: self->buffer_size = g_value_get_uint (value); break;
+      case prop_cache_budget: self->cache_budget = g_value_get_uint64 (value); cacheevict (self); break;
+      case prop_layer: self->layer = g_value_get_int (value); break;
+      case prop_read_ahead: self->read_ahead = g_value_get_uint (value); break;
+      case prop_recode_limit: self->recode_limit = g_value_get_uint64 (value); break;
+    }
+
+  g_mutex_unlock (&self->cache_lock);
+}
+
 static void lp_pack_reader_class_init (LpPackReaderClass* klass)
 {
   G_OBJECT_CLASS (klass)->dispose = lp_pack_reader_class_dispose;
   G_OBJECT_CLASS (klass)->finalize = lp_pack_reader_class_finalize;
+  G_OBJECT_CLASS (klass)->get_property = lp_pack_reader_class_get_property;
+  G_OBJECT_CLASS (klass)->set_property = lp_pack_reader_class_set_property;
+
+  properties [prop_buffer_size] = g_param_spec_uint ("buffer-size", "buffer-size", "buffer-size", 512, G_MAXUINT, LP_PACK_BUFFER_SIZE, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_CONSTRUCT);
+  properties [prop_cache_budget] = g_param_spec_uint64 ("cache-budget", "cache-budget", "cache-budget", 0, G_MAXUINT64, 0, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+  properties [prop_cache_hits] = g_param_spec_uint64 ("cache-hits", "cache-hits", "cache-hits", 0, G_MAXUINT64, 0, G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+  properties [prop_cache_misses] = g_param_spec_uint64 ("cache-misses", "cache-misses", "cache-misses", 0, G_MAXUINT64, 0, G_PARAM_STATIC_STRINGS | G_PARAM_READABLE);
+  properties [prop_layer] = g_param_spec_int ("layer", "layer", "layer", G_MININT, G_MAXINT, 0, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+  properties [prop_read_ahead] = g_param_spec_uint ("read-ahead", "read-ahead", "read-ahead", 0, G_MAXUINT, 0, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+  properties [prop_recode_limit] = g_param_spec_uint64 ("recode-limit", "recode-limit", "recode-limit", 0, G_MAXUINT64, 0, G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE);
+  g_object_class_install_properties (G_OBJECT_CLASS (klass), prop_number, properties);
 }
 
-static void lp_pack_reader_stream_init (LpPackReaderStream* self)
+static void wakesources (LpPackReaderStream* self)
 {
+  GSList* list = NULL;
+  GSList* next = NULL;
+
+  /*
+   * Queued sources are referenced by the stream, so none of them can
+   * be finalized under our feet; destroyed ones are dropped here.
+   * g_source_set_ready_time is safe to call from any thread
+   */
+  for (list = self->sources; list != NULL; list = next)
+    {
+      next = list->next;
+
+      if (g_source_is_destroyed (list->data) == FALSE)
+        g_source_set_ready_time (list->data, 0);
+      else
+        {
+          g_source_unref (list->data);
+          self->sources = g_slist_delete_link (self->sources, list);
+        }
+    }
 }
 
-static gboolean lp_pack_reader_stream_class_close_fn (GInputStream* pself, GCancellable* cancellable, GError** error)
+static void releasechunk (gpointer data)
 {
-  LpPackReaderStream* self = (gpointer) pself;
-return (closepack (self->ar, self->source, &self->reader, error) == ARCHIVE_OK);
+  lp_buffer_pool_release (data, LP_PACK_READ_AHEAD_CHUNK);
 }
 
-static gssize lp_pack_reader_stream_class_read_fn (GInputStream* pself, void* buffer, gsize count, GCancellable* cancellable, GError** error)
+static gpointer readahead (LpPackReaderStream* self)
 {
-  LpPackReaderStream* self = (gpointer) pself;
-  la_ssize_t result;
+  GError* tmperr = NULL;
+  gboolean done = FALSE;
 
-  if ((result = archive_read_data (self->ar, buffer, count)), G_UNLIKELY (result < 0))
+  /*
+   * Decompress up to self->depth chunks ahead of the consumer, which
+   * overlaps decoding with whatever the consumer does with the data
+   */
+  while (done == FALSE)
     {
-      report (error, archive_read_data, self->ar, &self->reader);
-      return -1;
+      gchar* data = lp_buffer_pool_acquire (LP_PACK_READ_AHEAD_CHUNK);
+      la_ssize_t result;
+
+      if ((result = archive_read_data (self->cursor->ar, data, LP_PACK_READ_AHEAD_CHUNK)), G_UNLIKELY (result < 0))
+        report (&tmperr, archive_read_data, self->cursor->ar, &self->cursor->reader);
+
+      g_mutex_lock (&self->lock);
+
+      if (result > 0)
+        g_queue_push_tail (&self->chunks, g_bytes_new_with_free_func (data, result, releasechunk, data));
+      else
+        {
+          releasechunk (data);
+          self->error = g_steal_pointer (&tmperr);
+          self->done = TRUE;
+        }
+
+      wakesources (self);
+      g_cond_broadcast (&self->cond);
+
+      while (self->stop == FALSE && self->done == FALSE && self->chunks.length >= self->depth)
+        g_cond_wait (&self->cond, &self->lock);
+
+      done = self->stop || self->done;
+      g_mutex_unlock (&self->lock);
     }
-return (gssize) result;
+return NULL;
 }
 
-static void lp_pack_reader_stream_class_dispose (GObject* pself)
+static gssize takechunk (LpPackReaderStream* self, void* buffer, gsize count)
 {
-  LpPackReaderStream* self = (gpointer) pself;
-  g_clear_pointer (&self->ar, (GDestroyNotify) archive_read_free);
-  g_clear_pointer (&self->source, (GDestroyNotify) source_unref);
-  G_OBJECT_CLASS (lp_pack_reader_parent_class)->dispose (pself);
+  GBytes* chunk = g_queue_peek_head (&self->chunks);
+  gsize size, take;
+  const gchar* data = g_bytes_get_data (chunk, &size);
+
+  take = MIN (count, size - self->consumed);
+  memcpy (buffer, data + self->consumed, take);
+
+  if ((self->consumed += take) == size)
+    {
+      g_bytes_unref (g_queue_pop_head (&self->chunks));
+      g_cond_broadcast (&self->cond);
+      self->consumed = 0;
+    }
+return (gssize) take;
 }
 
-static void lp_pack_reader_stream_class_init (LpPackReaderStreamClass* klass)
+static void on_cancelled (GCancellable* cancellable, LpPackReaderStream* self)
 {
-  G_INPUT_STREAM_CLASS (klass)->close_fn = lp_pack_reader_stream_class_close_fn;
-  G_INPUT_STREAM_CLASS (klass)->read_fn = lp_pack_reader_stream_class_read_fn;
-  G_OBJECT_CLASS (klass)->dispose = lp_pack_reader_stream_class_dispose;
+  g_mutex_lock (&self->lock);
+  g_cond_broadcast (&self->cond);
+  g_mutex_unlock (&self->lock);
 }
 
-static int walkpack (LpPackReader* self, Archive* ar, Source* source, Reader* reader, GError** error)
+static gssize readchunks (LpPackReaderStream* self, void* buffer, gsize count, gboolean blocking, GCancellable* cancellable, GError** error)
 {
-  ArchiveEntry* ent = NULL;
-  int result;
+  gulong handler = 0;
+  gssize result = -1;
+
+  if (blocking && cancellable != NULL)
+    handler = g_cancellable_connect (cancellable, G_CALLBACK (on_cancelled), self, NULL);
+
+  g_mutex_lock (&self->lock);
 
   while (TRUE)
     {
-      if ((result = archive_read_next_header (ar, &ent)), G_UNLIKELY (result != ARCHIVE_OK && result != ARCHIVE_EOF))
+      if (g_queue_is_empty (&self->chunks) == FALSE)
         {
-          report (error, archive_read_next_header, ar, reader);
+          result = takechunk (self, buffer, count);
           break;
         }
-      else if (result == ARCHIVE_EOF)
+      else if (self->done)
         {
-          result = ARCHIVE_OK;
+          if (G_LIKELY (self->error == NULL))
+            result = 0;
+          else
+            g_set_error_literal (error, self->error->domain, self->error->code, self->error->message);
           break;
         }
-
-      const gchar* path = archive_entry_pathname_utf8 (ent);
-
-      if (g_str_equal (path, LP_PACK_MANIFEST_PATH) == FALSE)
+      else if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        break;
+      else if (blocking == FALSE)
         {
-          File template =
-            {
-              .path = g_strdup (path),
-              .hash = g_str_hash (path),
-            };
-
-          if (g_tree_lookup_extended (self->vfs, &template, NULL, NULL) == FALSE)
-            g_tree_insert (self->vfs, g_slice_dup (File, &template), source_ref (source));
-          else
-            {
-              result = ARCHIVE_FATAL;
-              g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "duplicated entry '%s'", path);
-              g_free (template.path);
-              break;
-            }
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK, "no decompressed data available yet");
+          break;
         }
-      else if (source->manifest != NULL)
-        g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_MANIFEST, "duplicated manifest");
-      else
-        {
-          GKeyFile* keyfile;
-          gsize read, size;
-          gchar* data;
 
-          size = archive_entry_size (ent);
-          data = g_malloc (size);
+      g_cond_wait (&self->cond, &self->lock);
+    }
 
-          if ((result = archive_read_data (ar, data, size)), G_UNLIKELY (result < 0))
-            {
-              g_free (data);
-              report (error, archive_read_data, ar, reader);
-              break;
-            }
+  g_mutex_unlock (&self->lock);
 
-          keyfile = g_key_file_new ();
+  if (handler != 0)
+    g_cancellable_disconnect (cancellable, handler);
+  if (result > 0)
+    self->position += result;
+return result;
+}
 
-          if ((result = g_key_file_load_from_data (keyfile, data, size, 0, error)), G_UNLIKELY (result == TRUE))
-            g_free (data);
-          else
-            {
-              g_free (data);
-              g_key_file_free (keyfile);
-              break;
-            }
+static gboolean nextxzblock (LpPackReaderStream* self, GError** error)
+{
+  const goffset left = self->entry->size - self->position;
+  gssize read = 0;
 
-          source->manifest = keyfile;
-        }
+  if (left > 0 && G_UNLIKELY ((read = lp_xz_reader_read (self->xz, self->buffer, (gsize) MIN (left, (goffset) self->buffer_size), error)) < 0))
+    return FALSE;
+  else if (G_UNLIKELY (read == 0 && left > 0))
+    {
+      g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "truncated entry");
+      return FALSE;
     }
-return result;
+return (self->block = self->buffer, self->left = (gsize) read, TRUE);
 }
 
-static gboolean scanpack (LpPackReader* self, Source* source, GError** error)
+static gboolean nextblock (LpPackReaderStream* self, GError** error)
 {
-  Archive* ar = NULL;
-  Reader reader = {0};
+  const void* block = NULL;
+  la_int64_t offset;
+  size_t size = 0;
   int result;
 
-  ar = archive_read_new ();
+  /* past a checkpoint seek (see seekxz) entry data is decoded directly */
+  if (self->xz != NULL)
+    return nextxzblock (self, error);
 
-  if ((result = openpack (ar, source, &reader, error)), G_LIKELY (result == ARCHIVE_OK))
+  /*
+   * Data blocks are handed over by libarchive without copying
+   * them, so skipping forward costs no more than decoding
+   */
+  if ((result = archive_read_data_block (self->cursor->ar, &block, &size, &offset)), result == ARCHIVE_EOF)
+    size = 0;
+  else if (G_UNLIKELY (result < ARCHIVE_WARN))
     {
-      if ((result = walkpack (self, ar, source, &reader, error)), G_UNLIKELY (result != ARCHIVE_OK))
-        closepack (ar, source, &reader, NULL);
-      else
-        {
-          if ((result = closepack (ar, source, &reader, error)), G_LIKELY (result == ARCHIVE_OK))
-          if (source->manifest == NULL)
-            {
-              result = ARCHIVE_FATAL;
-              g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_MANIFEST, "missing manifest");
-            }
-        }
+      report (error, archive_read_data_block, self->cursor->ar, &self->cursor->reader);
+      return FALSE;
     }
-return (archive_read_free (ar), result == ARCHIVE_OK);
+return (self->block = block, self->left = size, TRUE);
 }
 
-/**
- * lp_pack_reader_add_from_bytes:
+static gssize readblocks (LpPackReaderStream* self, void* buffer, gsize count, GError** error)
+{
+  gsize take;
+
+  if (self->left == 0 && G_UNLIKELY (nextblock (self, error) == FALSE))
+    return -1;
+
+  take = MIN (count, self->left);
+  memcpy (buffer, self->block, take);
+
+  self->block += take;
+  self->left -= take;
+  self->position += take;
+return (gssize) take;
+}
+
+static gboolean readysource_prepare (GSource* source, gint* timeout)
+{
+  LpPackReaderStream* stream = ((ReadySource*) source)->stream;
+  return (*timeout = -1, g_pollable_input_stream_is_readable (G_POLLABLE_INPUT_STREAM (stream)));
+}
+
+static gboolean readysource_dispatch (GSource* source, GSourceFunc callback, gpointer user_data)
+{
+  g_source_set_ready_time (source, -1);
+return callback == NULL ? G_SOURCE_CONTINUE : callback (user_data);
+}
+
+static GSourceFuncs readysource_funcs =
+{
+  .prepare = readysource_prepare,
+  .dispatch = readysource_dispatch,
+};
+
+static void lp_pack_reader_stream_init (LpPackReaderStream* self)
+{
+  self->data = -1;
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->cond);
+  g_queue_init (&self->chunks);
+}
+
+static void lp_pack_reader_stream_start (LpPackReaderStream* self, guint depth)
+{
+  self->depth = depth;
+  self->worker = g_thread_new ("lp-read-ahead", (GThreadFunc) readahead, self);
+}
+
+static gboolean lp_pack_reader_stream_class_close_fn (GInputStream* pself, GCancellable* cancellable, GError** error)
+{
+  LpPackReaderStream* self = (gpointer) pself;
+
+  if (self->worker != NULL)
+    {
+      g_mutex_lock (&self->lock);
+      self->stop = TRUE;
+      g_cond_broadcast (&self->cond);
+      g_mutex_unlock (&self->lock);
+      g_thread_join (g_steal_pointer (&self->worker));
+    }
+
+  g_clear_pointer (&self->xz, lp_xz_reader_free);
+
+  if (self->cursor == NULL)
+    return TRUE;
+return parkcursor (self->entry->source, g_steal_pointer (&self->cursor), error);
+}
+
+static gssize lp_pack_reader_stream_class_read_fn (GInputStream* pself, void* buffer, gsize count, GCancellable* cancellable, GError** error)
+{
+  LpPackReaderStream* self = (gpointer) pself;
+
+  if (self->worker != NULL)
+    return readchunks (self, buffer, count, TRUE, cancellable, error);
+return readblocks (self, buffer, count, error);
+}
+
+static void lp_pack_reader_stream_class_dispose (GObject* pself)
+{
+  LpPackReaderStream* self = (gpointer) pself;
+
+  if (g_input_stream_is_closed (G_INPUT_STREAM (pself)) == FALSE)
+    g_input_stream_close (G_INPUT_STREAM (pself), NULL, NULL);
+
+  g_clear_pointer (&self->cursor, cursor_free);
+  g_clear_pointer (&self->xz, lp_xz_reader_free);
+  g_clear_pointer (&self->entry, entry_unref);
+  G_OBJECT_CLASS (lp_pack_reader_stream_parent_class)->dispose (pself);
+}
+
+static void lp_pack_reader_stream_class_finalize (GObject* pself)
+{
+  LpPackReaderStream* self = (gpointer) pself;
+
+  g_queue_clear_full (&self->chunks, (GDestroyNotify) g_bytes_unref);
+  g_slist_free_full (self->sources, (GDestroyNotify) g_source_unref);
+  g_clear_error (&self->error);
+  g_free (self->path);
+  lp_buffer_pool_release (self->buffer, self->buffer_size);
+  g_cond_clear (&self->cond);
+  g_mutex_clear (&self->lock);
+  G_OBJECT_CLASS (lp_pack_reader_stream_parent_class)->finalize (pself);
+}
+
+static void lp_pack_reader_stream_class_init (LpPackReaderStreamClass* klass)
+{
+  G_INPUT_STREAM_CLASS (klass)->close_fn = lp_pack_reader_stream_class_close_fn;
+  G_INPUT_STREAM_CLASS (klass)->read_fn = lp_pack_reader_stream_class_read_fn;
+  G_OBJECT_CLASS (klass)->dispose = lp_pack_reader_stream_class_dispose;
+  G_OBJECT_CLASS (klass)->finalize = lp_pack_reader_stream_class_finalize;
+}
+
+static gboolean lp_pack_reader_stream_g_pollable_input_stream_iface_can_poll (GPollableInputStream* pself)
+{
+  return ((LpPackReaderStream*) pself)->worker != NULL;
+}
+
+static gboolean lp_pack_reader_stream_g_pollable_input_stream_iface_is_readable (GPollableInputStream* pself)
+{
+  LpPackReaderStream* self = (gpointer) pself;
+  gboolean readable;
+
+  g_mutex_lock (&self->lock);
+  readable = self->done || g_queue_is_empty (&self->chunks) == FALSE;
+  g_mutex_unlock (&self->lock);
+return readable;
+}
+
+static GSource* lp_pack_reader_stream_g_pollable_input_stream_iface_create_source (GPollableInputStream* pself, GCancellable* cancellable)
+{
+  LpPackReaderStream* self = (gpointer) pself;
+  GSource* base = g_source_new (&readysource_funcs, sizeof (ReadySource));
+  GSource* source = NULL;
+
+  /*
+   * @base is only ever attached as a child of @source, which keeps
+   * the stream alive, while the stream keeps @base (see wakesources)
+   */
+  ((ReadySource*) base)->stream = self;
+
+  g_mutex_lock (&self->lock);
+  self->sources = g_slist_prepend (self->sources, base);
+  g_mutex_unlock (&self->lock);
+
+  source = g_pollable_source_new_full (pself, base, cancellable);
+return source;
+}
+
+static gssize lp_pack_reader_stream_g_pollable_input_stream_iface_read_nonblocking (GPollableInputStream* pself, void* buffer, gsize count, GError** error)
+{
+  return readchunks ((LpPackReaderStream*) pself, buffer, count, FALSE, NULL, error);
+}
+
+static void lp_pack_reader_stream_g_pollable_input_stream_iface_init (GPollableInputStreamInterface* iface)
+{
+  iface->can_poll = lp_pack_reader_stream_g_pollable_input_stream_iface_can_poll;
+  iface->is_readable = lp_pack_reader_stream_g_pollable_input_stream_iface_is_readable;
+  iface->create_source = lp_pack_reader_stream_g_pollable_input_stream_iface_create_source;
+  iface->read_nonblocking = lp_pack_reader_stream_g_pollable_input_stream_iface_read_nonblocking;
+}
+
+static goffset lp_pack_reader_stream_g_seekable_iface_tell (GSeekable* pself)
+{
+  return ((LpPackReaderStream*) pself)->position;
+}
+
+static gboolean lp_pack_reader_stream_g_seekable_iface_can_seek (GSeekable* pself)
+{
+  /* read ahead streams have data in flight which can not be rewound */
+  return ((LpPackReaderStream*) pself)->worker == NULL && g_input_stream_is_closed (G_INPUT_STREAM (pself)) == FALSE;
+}
+
+static gboolean seekxz (LpPackReaderStream* self, goffset target, GError** error)
+{
+  Source* source = self->entry->source;
+  GInputStream* stream = NULL;
+  LpXzReader* xz = NULL;
+  const goffset offset = self->data + MIN (target, self->entry->size);
+
+  /*
+   * Every xz block in a solid pack is a checkpoint decoding can
+   * start from (see LP_PACK_BLOCK_SIZE), so reaching @target costs
+   * at most decoding the head of the block holding it, wherever
+   * it lies within the entry
+   */
+  if ((stream = xzstream (source, error)), G_UNLIKELY (stream == NULL))
+    return FALSE;
+  else if ((xz = lp_xz_reader_new (source->xzindex, stream, source->type == source_stream ? &source->lock : NULL, offset, source->buffer_size, error), g_object_unref (stream)), G_UNLIKELY (xz == NULL))
+    return FALSE;
+
+  if (self->cursor != NULL)
+    {
+      closepack (self->cursor->ar, source, &self->cursor->reader, NULL);
+      g_clear_pointer (&self->cursor, cursor_free);
+    }
+
+  if (self->buffer == NULL)
+    self->buffer = lp_buffer_pool_acquire (self->buffer_size = source->buffer_size);
+
+  g_clear_pointer (&self->xz, lp_xz_reader_free);
+
+  self->xz = xz;
+  self->block = NULL;
+  self->left = 0;
+  self->position = target;
+return TRUE;
+}
+
+static gboolean lp_pack_reader_stream_g_seekable_iface_seek (GSeekable* pself, goffset offset, GSeekType type, GCancellable* cancellable, GError** error)
+{
+  LpPackReaderStream* self = (gpointer) pself;
+  ArchiveEntry* ent = NULL;
+  Cursor* cursor = NULL;
+  goffset target = offset;
+  gsize skip;
+
+  /* GSeekable does not check it, and closing drops the cursor */
+  if (G_UNLIKELY (g_input_stream_is_closed (G_INPUT_STREAM (pself))))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED, "stream is already closed");
+      return FALSE;
+    }
+  else if (G_UNLIKELY (self->worker != NULL))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "can not seek a read ahead stream");
+      return FALSE;
+    }
+
+  switch (type)
+    {
+      case G_SEEK_SET: break;
+      case G_SEEK_CUR: target += self->position; break;
+      case G_SEEK_END:
+        {
+          if (G_UNLIKELY (self->entry->size < 0))
+            {
+              g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "entry size is unknown");
+              return FALSE;
+            }
+
+          target += self->entry->size;
+          break;
+        }
+    }
+
+  if (G_UNLIKELY (target < 0))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "invalid seek offset");
+      return FALSE;
+    }
+
+  /*
+   * Going backwards, or far enough forward to cross a block, is
+   * done from the nearest xz block whenever entry data lies at a
+   * known place in an indexed solid pack
+   */
+  if (self->data >= 0 && (target < self->position || target - self->position >= LP_PACK_BLOCK_SIZE))
+    return seekxz (self, target, error);
+
+  /*
+   * Otherwise decoder state can not be rewound, so going backwards
+   * means decoding the entry again. opencursor starts doing so at
+   * the entry itself whenever the pack layout allows it, instead
+   * of at the start of the pack
+   */
+  if (target < self->position)
+    {
+      if ((cursor = opencursor (self->entry, self->path, &ent, cancellable, error)), G_UNLIKELY (cursor == NULL))
+        return FALSE;
+
+      if (self->cursor != NULL)
+        {
+          closepack (self->cursor->ar, self->entry->source, &self->cursor->reader, NULL);
+          cursor_free (self->cursor);
+        }
+
+      self->cursor = cursor;
+      self->block = NULL;
+      self->left = 0;
+      self->position = 0;
+    }
+
+  while (self->position < target)
+    {
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        return FALSE;
+      else if (self->left == 0 && G_UNLIKELY (nextblock (self, error) == FALSE))
+        return FALSE;
+      else if (self->left == 0)
+        {
+          /* past the end, reads will just return zero bytes */
+          self->position = target;
+          break;
+        }
+
+      skip = (gsize) MIN ((goffset) self->left, target - self->position);
+      self->block += skip;
+      self->left -= skip;
+      self->position += skip;
+    }
+return TRUE;
+}
+
+static gboolean lp_pack_reader_stream_g_seekable_iface_can_truncate (GSeekable* pself)
+{
+  return FALSE;
+}
+
+static gboolean lp_pack_reader_stream_g_seekable_iface_truncate (GSeekable* pself, goffset offset, GCancellable* cancellable, GError** error)
+{
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "can not truncate a packed file");
+return FALSE;
+}
+
+static void lp_pack_reader_stream_g_seekable_iface_init (GSeekableIface* iface)
+{
+  iface->tell = lp_pack_reader_stream_g_seekable_iface_tell;
+  iface->can_seek = lp_pack_reader_stream_g_seekable_iface_can_seek;
+  iface->seek = lp_pack_reader_stream_g_seekable_iface_seek;
+  iface->can_truncate = lp_pack_reader_stream_g_seekable_iface_can_truncate;
+  iface->truncate_fn = lp_pack_reader_stream_g_seekable_iface_truncate;
+}
+
+static void staged_init (Staged* staged)
+{
+  staged->entries = g_array_new (FALSE, FALSE, sizeof (Entry));
+  staged->times = g_array_new (FALSE, FALSE, sizeof (Times));
+  staged->paths = g_ptr_array_new ();
+  staged->timed = FALSE;
+  staged->sidecar = NULL;
+}
+
+static void staged_clear (Staged* staged)
+{
+  g_clear_pointer (&staged->entries, g_array_unref);
+  g_clear_pointer (&staged->times, g_array_unref);
+  g_clear_pointer (&staged->paths, g_ptr_array_unref);
+  g_clear_pointer (&staged->sidecar, sidecar_free);
+}
+
+static void addentry (Staged* staged, Source* source, const gchar* path, const Entry* stat, const Times* times)
+{
+  Entry entry = *stat;
+
+  entry.source = source;
+  staged->timed |= (stat->flags & (LP_PACK_INDEX_HAS_ATIME | LP_PACK_INDEX_HAS_CTIME | LP_PACK_INDEX_HAS_BIRTHTIME)) != 0;
+
+  g_array_append_val (staged->entries, entry);
+  g_array_append_vals (staged->times, times, 1);
+  g_ptr_array_add (staged->paths, g_string_chunk_insert (source->names, path));
+}
+
+static gboolean loadmanifest (Source* source, const gchar* data, gsize size, GError** error)
+{
+  GKeyFile* keyfile;
+
+  if (G_UNLIKELY (source->manifest != NULL))
+    {
+      g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_MANIFEST, "duplicated manifest");
+      return FALSE;
+    }
+
+  keyfile = g_key_file_new ();
+
+  if (G_UNLIKELY (g_key_file_load_from_data (keyfile, data, size, 0, error) == FALSE))
+    {
+      g_key_file_free (keyfile);
+      return FALSE;
+    }
+return (source->manifest = keyfile, TRUE);
+}
+
+static void dropsource (Staged* staged, Source* source)
+{
+  g_array_set_size (staged->entries, 0);
+  g_array_set_size (staged->times, 0);
+  g_ptr_array_set_size (staged->paths, 0);
+  g_string_chunk_clear (source->names);
+  staged->timed = FALSE;
+  _g_key_file_free0 (source->manifest);
+  source->layout = LP_PACK_LAYOUT_SOLID;
+}
+
+static gboolean indexstaged (Staged* staged, Source* source, LpPathIndex* index, GError** error)
+{
+  const gchar* path = NULL;
+  gsize length;
+  guint i;
+
+  source->n_entries = staged->entries->len;
+  source->entries = (Entry*) g_array_free (g_steal_pointer (&staged->entries), FALSE);
+
+  if (staged->timed)
+    source->times = (Times*) g_array_free (g_steal_pointer (&staged->times), FALSE);
+
+  for (i = 0; i < source->n_entries; ++i)
+    {
+      path = g_ptr_array_index (staged->paths, i);
+      length = strlen (path);
+
+      if (G_UNLIKELY (lp_path_index_insert (index, path, length, lp_path_hash (path, length), source->entries + i) == FALSE))
+        {
+          g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "duplicated entry '%s'", path);
+          return FALSE;
+        }
+    }
+return TRUE;
+}
+
+static void linkchild (Dir* dir, const gchar* path, gsize length, Dir* sub, GPtrArray* touched)
+{
+  Child child = { .path = path, .length = length, .dir = sub, };
+
+  g_array_append_val (dir->children, child);
+
+  if (dir->dirty == FALSE)
+    {
+      dir->dirty = TRUE;
+      g_ptr_array_add (touched, dir);
+    }
+}
+
+static gsize parentof (const gchar* path, gsize length)
+{
+  while (length > 0 && path [--length] != '/');
+return length;
+}
+
+static void adoptchild (Dir* dir, const gchar* path, gsize length, Dir* sub)
+{
+  Child* child = NULL;
+  guint i;
+
+  for (i = 0; i < dir->children->len; ++i)
+    {
+      child = & g_array_index (dir->children, Child, i);
+
+      if (child->length == length && memcmp (child->path, path, length) == 0)
+        {
+          child->dir = sub;
+          break;
+        }
+    }
+}
+
+static Dir* linkdir (LpPackReader* self, const gchar* path, gsize length, GPtrArray* touched)
+{
+  const guint32 hash = lp_path_hash (path, length);
+  Dir* parent = NULL;
+  Dir* dir = NULL;
+
+  if ((dir = lp_path_index_lookup (self->dirs, path, length, hash, NULL)) == NULL)
+    {
+      dir = dir_new ();
+      lp_path_index_insert (self->dirs, path, length, hash, dir);
+      parent = linkdir (self, path, parentof (path, length), touched);
+
+      /* a lower layer file this directory shadows is listed already */
+      if (lp_path_index_lookup (self->vfs, path, length, hash, NULL) == NULL)
+        linkchild (parent, path, length, dir, touched);
+      else
+        adoptchild (parent, path, length, dir);
+    }
+return dir;
+}
+
+static gint child_cmp (const Child* child_a, const Child* child_b)
+{
+  gint result = memcmp (child_a->path, child_b->path, MIN (child_a->length, child_b->length));
+return result != 0 ? result : (child_a->length > child_b->length) - (child_a->length < child_b->length);
+}
+
+static void linkentries (LpPackReader* self, Source* source, GPtrArray* paths)
+{
+  GPtrArray* touched = g_ptr_array_new ();
+  const gchar* path = NULL;
+  guint32 hash;
+  gsize length;
+  guint i;
+
+  for (i = 0; i < paths->len; ++i)
+    {
+      path = g_ptr_array_index (paths, i);
+      length = strlen (path);
+
+      if (S_ISDIR (source->entries [i].mode) == FALSE)
+        {
+          hash = lp_path_hash (path, length);
+
+          /* paths in other layers are listed already, whichever wins */
+          if (lp_path_index_lookup (self->vfs, path, length, hash, NULL) == NULL
+            && lp_path_index_lookup (self->dirs, path, length, hash, NULL) == NULL)
+            linkchild (linkdir (self, path, parentof (path, length), touched), path, length, NULL, touched);
+        }
+      else
+        {
+          while (length > 0 && path [length - 1] == '/')
+            --length;
+
+          linkdir (self, path, length, touched);
+        }
+    }
+
+  for (i = 0; i < touched->len; ++i)
+    {
+      Dir* dir = g_ptr_array_index (touched, i);
+
+      g_array_sort (dir->children, (GCompareFunc) child_cmp);
+      dir->dirty = FALSE;
+    }
+
+  g_ptr_array_free (touched, TRUE);
+}
+
+static gboolean shadows (const gchar* path, gpointer current, gpointer value, gpointer user_data)
+{
+  return ((Entry*) value)->source->layer >= ((Entry*) current)->source->layer;
+}
+
+static gboolean isfile (LpPackReader* self, const gchar* path, gsize length)
+{
+  Entry* entry = lp_path_index_lookup (self->vfs, path, length, lp_path_hash (path, length), NULL);
+return entry != NULL && S_ISDIR (entry->mode) == FALSE;
+}
+
+static gsize fileprefix (LpPackReader* self, const gchar* path, gsize length)
+{
+  /* prefixes found among directories are clear, and so are all of theirs */
+  while ((length = parentof (path, length)) > 0)
+    {
+      if (lp_path_index_lookup (self->dirs, path, length, lp_path_hash (path, length), NULL) != NULL)
+        return 0;
+      else if (isfile (self, path, length))
+        return length;
+    }
+return 0;
+}
+
+static gboolean clashes (LpPackReader* self, Source* source, GPtrArray* paths, GError** error)
+{
+  const gchar* path = NULL;
+  gsize length, prefix;
+  guint i;
+
+  /*
+   * A path which is a file in one pack and a directory in another
+   * (or has files under it) could be neither consistently, so such
+   * packs are refused whatever their layers
+   */
+  for (i = 0; i < paths->len; ++i)
+    {
+      path = g_ptr_array_index (paths, i);
+      length = strlen (path);
+
+      if (S_ISDIR (source->entries [i].mode) == FALSE)
+        {
+          if (lp_path_index_lookup (self->dirs, path, length, lp_path_hash (path, length), NULL) != NULL)
+            break;
+        }
+      else
+        {
+          while (length > 0 && path [length - 1] == '/')
+            --length;
+
+          if (isfile (self, path, length))
+            break;
+        }
+
+      if ((prefix = fileprefix (self, path, length)) > 0)
+        {
+          length = prefix;
+          break;
+        }
+    }
+
+  if (G_LIKELY (i == paths->len))
+    return FALSE;
+return (g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "path '%.*s' is both a file and a directory", (int) length, path), TRUE);
+}
+
+static gboolean mergestaged (LpPackReader* self, Source* source, GPtrArray* paths, LpPathIndex* index, GError** error)
+{
+  /*
+   * Entries are only published once their pack was completely
+   * scanned, and never removed afterwards (nor moved, as they
+   * live in their source which @self keeps alive), so lookups
+   * need just hold the lock while searching the index. Paths
+   * found in more than one pack are resolved here, once, to the
+   * entry on the highest layer (the last merged one, if tied),
+   * so lookups never look past the first entry they find
+   */
+  g_rw_lock_writer_lock (&self->lock);
+
+  if (G_UNLIKELY (clashes (self, source, paths, error)))
+    {
+      g_rw_lock_writer_unlock (&self->lock);
+      return FALSE;
+    }
+
+  g_ptr_array_add (self->sources, source_ref (source));
+  linkentries (self, source, paths);
+  lp_path_index_merge (self->vfs, index, shadows, NULL);
+  g_rw_lock_writer_unlock (&self->lock);
+return TRUE;
+}
+
+static int walkpack (Staged* staged, Archive* ar, Source* source, Reader* reader, GHashTable* entries, GError** error)
+{
+  ArchiveEntry* ent = NULL;
+  int result;
+
+  while (TRUE)
+    {
+      if (G_UNLIKELY (g_cancellable_set_error_if_cancelled (reader->cancellable, error)))
+        {
+          result = ARCHIVE_FATAL;
+          break;
+        }
+      else if ((result = archive_read_next_header (ar, &ent)), G_UNLIKELY (result != ARCHIVE_OK && result != ARCHIVE_EOF))
+        {
+          report (error, archive_read_next_header, ar, reader);
+          break;
+        }
+      else if (result == ARCHIVE_EOF)
+        {
+          result = ARCHIVE_OK;
+          break;
+        }
+
+      const gchar* path = archive_entry_pathname_utf8 (ent);
+
+      if (entries != NULL)
+        lp_pack_index_add (entries, ent, archive_read_header_position (ar));
+
+      if (g_str_equal (path, LP_PACK_MANIFEST_PATH) == FALSE)
+        {
+          Entry stat = {0};
+          Times times = {0};
+
+          if (G_UNLIKELY (entry_stat (&stat, &times, archive_read_header_position (ar), ent) == FALSE))
+            {
+              g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "entry '%s' is too large", path);
+              result = ARCHIVE_FATAL;
+              break;
+            }
+
+          addentry (staged, source, path, &stat, &times);
+        }
+      else
+        {
+          gsize size;
+          gchar* data;
+
+          size = archive_entry_size (ent);
+          data = g_malloc (size);
+
+          if ((result = archive_read_data (ar, data, size)), G_UNLIKELY (result < 0))
+            {
+              g_free (data);
+              report (error, archive_read_data, ar, reader);
+              break;
+            }
+
+          if ((result = loadmanifest (source, data, size, error)), G_LIKELY (result == TRUE))
+            {
+              g_free (data);
+              result = ARCHIVE_OK;
+            }
+          else
+            {
+              g_free (data);
+              result = ARCHIVE_FATAL;
+              break;
+            }
+        }
+    }
+return result;
+}
+
+static GBytes* readrange (GInputStream* stream, goffset offset, gsize size, GError** error)
+{
+  gchar* data = NULL;
+  gsize read = 0;
+
+  if (G_UNLIKELY (g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, NULL, error) == FALSE))
+    return NULL;
+
+  data = g_malloc (size);
+
+  if (G_UNLIKELY (g_input_stream_read_all (stream, data, size, &read, NULL, error) == FALSE))
+    {
+      g_free (data);
+      return NULL;
+    }
+  else if (G_UNLIKELY (read < size))
+    {
+      g_free (data);
+      g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "truncated pack");
+      return NULL;
+    }
+return g_bytes_new_take (data, size);
+}
+
+static gboolean readtrailer (Source* source, GInputStream* stream, GBytes** index, GError** error)
+{
+  LpPackTrailer trailer = {0};
+  GBytes* bytes = NULL;
+  goffset size = 0;
+
+  if (stream == NULL)
+    size = g_bytes_get_size (source_get_bytes (source));
+  else
+    {
+      if (G_IS_SEEKABLE (stream) == FALSE || g_seekable_can_seek (G_SEEKABLE (stream)) == FALSE)
+        return TRUE;
+      if (g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_END, NULL, error) == FALSE)
+        return FALSE;
+
+      size = g_seekable_tell (G_SEEKABLE (stream));
+    }
+
+  if (size < sizeof (trailer))
+    return TRUE;
+  else if (stream == NULL)
+    memcpy (&trailer, ((const gchar*) g_bytes_get_data (source_get_bytes (source), NULL)) + size - sizeof (trailer), sizeof (trailer));
+  else
+    {
+      if ((bytes = readrange (stream, size - sizeof (trailer), sizeof (trailer), error)) == NULL)
+        return FALSE;
+
+      memcpy (&trailer, g_bytes_get_data (bytes, NULL), sizeof (trailer));
+      g_bytes_unref (bytes);
+    }
+
+  if (memcmp (trailer.magic, LP_PACK_INDEX_MAGIC, sizeof (trailer.magic)) != 0)
+    return TRUE;
+  else
+    {
+      const guint64 length = GUINT64_FROM_LE (trailer.length);
+      const guint64 offset = GUINT64_FROM_LE (trailer.offset);
+      const guint64 limit = (guint64) size - sizeof (trailer);
+      const guint64 count = GUINT64_FROM_LE (trailer.size);
+
+      if (G_UNLIKELY (length > offset || offset > limit || count > limit - offset))
+        {
+          g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "corrupted index trailer");
+          return FALSE;
+        }
+
+      if (stream == NULL)
+        *index = g_bytes_new_from_bytes (source_get_bytes (source), offset, count);
+      else if ((*index = readrange (stream, offset, count, error)) == NULL)
+        return FALSE;
+
+      source->length = (goffset) length;
+    }
+return TRUE;
+}
+
+static gboolean loadindex (Source* source, GBytes** index, GError** error)
+{
+  GFileInputStream* stream = NULL;
+  gboolean good = TRUE;
+
+  switch (source_get_bytes (source) != NULL ? source_bytes : source->type)
+    {
+      case source_bytes:
+        good = readtrailer (source, NULL, index, error);
+        break;
+
+      case source_file:
+        if ((stream = g_file_read (source->file, NULL, error)) == NULL)
+          good = FALSE;
+        else
+          {
+            good = readtrailer (source, G_INPUT_STREAM (stream), index, error);
+            g_object_unref (stream);
+          }
+        break;
+
+      case source_stream:
+        good = readtrailer (source, source->stream, index, error);
+        break;
+    }
+return good;
+}
+
+static void probexz (Source* source)
+{
+  GInputStream* stream = NULL;
+  GError* tmperr = NULL;
+  goffset length = source->recoded == NULL ? source->length : (goffset) g_bytes_get_size (source->recoded);
+
+  if (source->layout != LP_PACK_LAYOUT_SOLID)
+    return;
+  if ((stream = xzstream (source, &tmperr)), G_UNLIKELY (stream == NULL))
+    {
+      g_error_free (tmperr);
+      return;
+    }
+
+  if (G_IS_SEEKABLE (stream) && g_seekable_can_seek (G_SEEKABLE (stream)))
+    {
+      if (length < 0 && g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_END, NULL, NULL))
+        length = g_seekable_tell (G_SEEKABLE (stream));
+
+      /*
+       * Packs without a usable block index (not xz, concatenated
+       * streams or a single block) keep being read from the start
+       */
+      if (length >= 0 && (source->xzindex = lp_xz_index_load (stream, length, &tmperr)) == NULL)
+        g_error_free (tmperr);
+      else if (source->xzindex != NULL && lp_xz_index_get_blocks (source->xzindex) < 2)
+        g_clear_pointer (&source->xzindex, lp_xz_index_free);
+    }
+  g_object_unref (stream);
+}
+
+static gboolean walkindex (Staged* staged, Source* source, GBytes* index, GError** error)
+{
+  GvdbTable* entries = NULL;
+  GvdbTable* table = NULL;
+  GVariant* layout = NULL;
+  GVariant* manifest = NULL;
+  gboolean good = TRUE;
+  gchar** names = NULL;
+  gsize i, length = 0;
+
+  if ((table = gvdb_table_new_from_bytes (index, FALSE, error)) == NULL)
+    return FALSE;
+  else if ((entries = gvdb_table_get_table (table, LP_PACK_INDEX_ENTRIES)) == NULL
+        || (manifest = gvdb_table_get_value (table, LP_PACK_INDEX_MANIFEST)) == NULL
+        || g_variant_is_of_type (manifest, G_VARIANT_TYPE_STRING) == FALSE
+        || ((layout = gvdb_table_get_value (table, LP_PACK_INDEX_LAYOUT)) != NULL
+          && (g_variant_is_of_type (layout, G_VARIANT_TYPE_UINT32) == FALSE
+            || g_variant_get_uint32 (layout) > LP_PACK_LAYOUT_STORED)))
+    {
+      g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "malformed index");
+      good = FALSE;
+    }
+  else
+    {
+      const gchar* data = g_variant_get_string (manifest, &length);
+
+      source->layout = layout == NULL ? LP_PACK_LAYOUT_SOLID : g_variant_get_uint32 (layout);
+
+      if ((good = loadmanifest (source, data, length, error)), G_LIKELY (good == TRUE))
+        {
+          names = gvdb_table_get_names (entries, &length);
+
+          for (i = 0; i < length && good; ++i)
+            {
+              GVariant* value;
+              guint64 offset, size;
+              guint32 mode, flags;
+              Entry stat = {0};
+              Times times = {0};
+
+              if (g_str_equal (names [i], LP_PACK_MANIFEST_PATH))
+                continue;
+              else if ((value = gvdb_table_get_value (entries, names [i])) == NULL
+                    || g_variant_is_of_type (value, G_VARIANT_TYPE (LP_PACK_INDEX_ENTRY)) == FALSE)
+                {
+                  g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "malformed index entry '%s'", names [i]);
+                  g_clear_pointer (&value, g_variant_unref);
+                  good = FALSE;
+                }
+              else
+                {
+                  g_variant_get (value, LP_PACK_INDEX_ENTRY, &offset, &size, &mode, &flags,
+                                 &times.atime.sec, &times.atime.nsec,
+                                 &times.ctime.sec, &times.ctime.nsec,
+                                 &times.btime.sec, &times.btime.nsec);
+                  g_variant_unref (value);
+
+                  if (G_UNLIKELY (entry_fits ((goffset) offset, (goffset) size) == FALSE))
+                    {
+                      g_set_error (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN, "entry '%s' is too large", names [i]);
+                      good = FALSE;
+                    }
+                  else
+                    {
+                      stat.offset = (goffset) offset;
+                      stat.size = (goffset) size;
+                      stat.mode = mode;
+                      stat.flags = flags;
+                      addentry (staged, source, names [i], &stat, &times);
+                    }
+                }
+            }
+
+          g_strfreev (names);
+        }
+    }
+
+  g_clear_pointer (&layout, g_variant_unref);
+  g_clear_pointer (&manifest, g_variant_unref);
+  g_clear_pointer (&entries, gvdb_table_free);
+return (gvdb_table_free (table), good);
+}
+
+static gchar* cachepath (GFile* file)
+{
+  gchar* uri = g_file_get_uri (file);
+  gchar* name = g_compute_checksum_for_string (G_CHECKSUM_SHA256, uri, -1);
+  gchar* path = g_build_filename (g_get_user_cache_dir (), LP_PACK_CACHE_DIR, name, NULL);
+return (g_free (uri), g_free (name), path);
+}
+
+static gboolean stamppack (GFile* file, Stamp* stamp, GError** error)
+{
+  const gchar* attributes = G_FILE_ATTRIBUTE_STANDARD_SIZE "," G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC;
+  GFileInputStream* stream = NULL;
+  GChecksum* checksum = NULL;
+  GFileInfo* info = NULL;
+  GBytes* bytes = NULL;
+  gsize head, tail, size;
+
+  if ((info = g_file_query_info (file, attributes, 0, NULL, error)) == NULL)
+    return FALSE;
+
+  size = (gsize) g_file_info_get_size (info);
+  stamp->size = size;
+  stamp->mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC
+               + g_file_info_get_attribute_uint32 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC);
+  g_object_unref (info);
+
+  if ((stream = g_file_read (file, NULL, error)) == NULL)
+    return FALSE;
+
+  /*
+   * Only pack head and tail are hashed, hashing the whole
+   * file would cost about as much as scanning it
+   */
+  checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  head = MIN (size, LP_PACK_CACHE_SAMPLE);
+  tail = MIN (size - head, LP_PACK_CACHE_SAMPLE);
+
+  if ((bytes = readrange (G_INPUT_STREAM (stream), 0, head, error)) != NULL)
+    {
+      g_checksum_update (checksum, g_bytes_get_data (bytes, NULL), head);
+      g_bytes_unref (bytes);
+
+      if ((bytes = readrange (G_INPUT_STREAM (stream), size - tail, tail, error)) != NULL)
+        {
+          g_checksum_update (checksum, g_bytes_get_data (bytes, NULL), tail);
+          g_bytes_unref (bytes);
+
+          stamp->digest = g_strdup (g_checksum_get_string (checksum));
+        }
+    }
+
+  g_checksum_free (checksum);
+  g_object_unref (stream);
+return stamp->digest != NULL;
+}
+
+static gboolean checkstamp (GvdbTable* table, Stamp* stamp)
+{
+  GVariant* digest = gvdb_table_get_value (table, LP_PACK_CACHE_DIGEST);
+  GVariant* mtime = gvdb_table_get_value (table, LP_PACK_CACHE_MTIME);
+  GVariant* size = gvdb_table_get_value (table, LP_PACK_CACHE_SIZE);
+  gboolean good;
+
+  good = digest != NULL && g_variant_is_of_type (digest, G_VARIANT_TYPE_STRING)
+      && mtime != NULL && g_variant_is_of_type (mtime, G_VARIANT_TYPE_UINT64)
+      && size != NULL && g_variant_is_of_type (size, G_VARIANT_TYPE_UINT64)
+      && g_variant_get_uint64 (size) == stamp->size
+      && g_variant_get_uint64 (mtime) == stamp->mtime
+      && g_str_equal (g_variant_get_string (digest, NULL), stamp->digest);
+
+  g_clear_pointer (&digest, g_variant_unref);
+  g_clear_pointer (&mtime, g_variant_unref);
+  g_clear_pointer (&size, g_variant_unref);
+return good;
+}
+
+static void loadrecoded (Source* source, GvdbTable* table, const gchar* path)
+{
+  GVariant* size = gvdb_table_get_value (table, LP_PACK_CACHE_RECODED);
+  GMappedFile* mapped = NULL;
+  gchar* name = NULL;
+
+  /* a recoded copy is trusted as long as it was fully written */
+  if (size != NULL && g_variant_is_of_type (size, G_VARIANT_TYPE_UINT64))
+    {
+      name = g_strconcat (path, LP_PACK_CACHE_RECODED_SUFFIX, NULL);
+
+      if ((mapped = g_mapped_file_new (name, FALSE, NULL)) != NULL)
+        {
+          if (g_mapped_file_get_length (mapped) == g_variant_get_uint64 (size))
+            source->recoded = g_mapped_file_get_bytes (mapped);
+
+          g_mapped_file_unref (mapped);
+        }
+
+      g_free (name);
+    }
+
+  g_clear_pointer (&size, g_variant_unref);
+}
+
+static void droprecoded (const gchar* path)
+{
+  gchar* name = g_strconcat (path, LP_PACK_CACHE_RECODED_SUFFIX, NULL);
+
+  if (g_unlink (name) < 0 && errno != ENOENT)
+    g_warning ("can not remove recoded pack '%s': %s", name, g_strerror (errno));
+  g_free (name);
+}
+
+static gboolean loadcache (Staged* staged, Source* source, const gchar* path, Stamp* stamp)
+{
+  GMappedFile* mapped = NULL;
+  GvdbTable* table = NULL;
+  GBytes* bytes = NULL;
+  gboolean good = FALSE;
+
+  if ((mapped = g_mapped_file_new (path, FALSE, NULL)) == NULL)
+    return FALSE;
+
+  bytes = g_mapped_file_get_bytes (mapped);
+  g_mapped_file_unref (mapped);
+
+  if ((table = gvdb_table_new_from_bytes (bytes, FALSE, NULL)) != NULL)
+    {
+      if ((good = checkstamp (table, stamp)))
+        loadrecoded (source, table, path);
+
+      gvdb_table_free (table);
+    }
+
+  /* a stale recoded copy is as large as the pack, do not keep it around */
+  if (good == FALSE)
+    droprecoded (path);
+
+  if (good && (good = walkindex (staged, source, bytes, NULL)) == FALSE)
+    {
+      g_clear_pointer (&source->recoded, g_bytes_unref);
+      dropsource (staged, source);
+    }
+return (g_bytes_unref (bytes), good);
+}
+
+static guint64 recodepack (Source* source, const gchar* path, GCancellable* cancellable)
+{
+  gchar* name = g_strconcat (path, LP_PACK_CACHE_RECODED_SUFFIX, NULL);
+  GFile* file = g_file_new_for_path (name);
+  GFileOutputStream* output = NULL;
+  GCancellable* abort = NULL;
+  GInputStream* input = NULL;
+  GError* tmperr = NULL;
+  guint64 size = 0;
+
+  if ((input = sourcestream (source, &tmperr)) != NULL)
+  if ((output = g_file_replace (file, NULL, FALSE, G_FILE_CREATE_PRIVATE, cancellable, &tmperr)) != NULL)
+    {
+      if (lp_xz_recode (input, G_OUTPUT_STREAM (output), LP_PACK_CACHE_PRESET, LP_PACK_BLOCK_SIZE, source->buffer_size, cancellable, &tmperr))
+        size = (guint64) g_seekable_tell (G_SEEKABLE (output));
+      else
+        {
+          /* closing a cancelled replacement leaves the old file alone */
+          g_cancellable_cancel (abort = g_cancellable_new ());
+        }
+
+      if (g_output_stream_close (G_OUTPUT_STREAM (output), abort, tmperr == NULL ? &tmperr : NULL) == FALSE)
+        size = 0;
+    }
+
+  if (tmperr == NULL)
+    ;
+  else if (g_error_matches (tmperr, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    g_debug ("recoding into '%s' cancelled", name);
+  else
+    g_warning ("can not recode pack into '%s': %s", name, tmperr->message);
+
+  _g_object_unref0 (abort);
+  _g_object_unref0 (input);
+  _g_object_unref0 (output);
+  g_clear_error (&tmperr);
+  g_object_unref (file);
+return (g_free (name), size);
+}
+
+static void writecache (Source* source, const gchar* path, Stamp* stamp, GHashTable* entries, guint64 recoded)
+{
+  GHashTable* root = lp_pack_index_new_root (source->manifest, source->layout, entries);
+  GError* tmperr = NULL;
+  GString* data = NULL;
+
+  gvdb_item_set_value (gvdb_hash_table_insert (root, LP_PACK_CACHE_DIGEST), g_variant_new_string (stamp->digest));
+  gvdb_item_set_value (gvdb_hash_table_insert (root, LP_PACK_CACHE_MTIME), g_variant_new_uint64 (stamp->mtime));
+  gvdb_item_set_value (gvdb_hash_table_insert (root, LP_PACK_CACHE_SIZE), g_variant_new_uint64 (stamp->size));
+
+  if (recoded > 0)
+    gvdb_item_set_value (gvdb_hash_table_insert (root, LP_PACK_CACHE_RECODED), g_variant_new_uint64 (recoded));
+
+  data = gvdb_table_serialize (root, FALSE);
+
+  if (g_file_set_contents (path, data->str, data->len, &tmperr) == FALSE)
+    {
+      g_warning ("can not write pack cache '%s': %s", path, tmperr->message);
+      g_error_free (tmperr);
+    }
+
+  g_hash_table_unref (root);
+  g_string_free (data, TRUE);
+}
+
+static void writesidecar (Sidecar* sidecar, gpointer user_data)
+{
+  Source* source = sidecar->source;
+  gchar* dirname = g_path_get_dirname (sidecar->path);
+  guint64 recoded = 0;
+
+  /*
+   * Caches are an optimization, failing to write one is not an
+   * error. Single block packs can not be seeked into, so they may
+   * be recoded into ones which can be (see queuesidecar), which
+   * costs about as much as building them, hence is done here and
+   * not while scanning. The recoded copy is written first, so a
+   * cache never refers to an incomplete one
+   */
+  if (g_mkdir_with_parents (dirname, 0700) < 0)
+    g_warning ("can not create cache directory '%s': %s", dirname, g_strerror (errno));
+  else
+    {
+      if (sidecar->recode)
+        recoded = recodepack (source, sidecar->path, sidecar->cancellable);
+      if (recoded == 0)
+        droprecoded (sidecar->path);
+
+      writecache (source, sidecar->path, &sidecar->stamp, sidecar->entries, recoded);
+    }
+
+  g_free (dirname);
+  sidecar_free (sidecar);
+}
+
+static la_ssize_t on_teeread (struct archive* ar, void* user_data, const void** out_buffer)
+{
+  gchar* buffer = G_STRUCT_MEMBER (gchar*, user_data, G_STRUCT_OFFSET (Reader, buffer));
+  GCancellable* cancellable = G_STRUCT_MEMBER (GCancellable*, user_data, G_STRUCT_OFFSET (Reader, cancellable));
+  GError** error = & G_STRUCT_MEMBER (GError*, user_data, G_STRUCT_OFFSET (Reader, error));
+  GInputStream* stream = G_STRUCT_MEMBER (GInputStream*, user_data, G_STRUCT_OFFSET (Reader, stream));
+  goffset* position = & G_STRUCT_MEMBER (goffset, user_data, G_STRUCT_OFFSET (Reader, position));
+  gsize count = G_STRUCT_MEMBER (gsize, user_data, G_STRUCT_OFFSET (Reader, buffer_size));
+  gint spill = G_STRUCT_MEMBER (gint, user_data, G_STRUCT_OFFSET (Reader, spill));
+  gssize result = ARCHIVE_OK;
+
+  /* every chunk handed to libarchive is spilled first */
+  if ((result = g_input_stream_read (stream, buffer, count, cancellable, error)), G_UNLIKELY (result < 0))
+    result = (gssize) ARCHIVE_FATAL;
+  else if (G_UNLIKELY (lp_anon_file_write (spill, buffer, result, error) == FALSE))
+    result = (gssize) ARCHIVE_FATAL;
+  else
+    *position += result;
+return (*out_buffer = buffer, result);
+}
+
+static gboolean spillpack (Source* source, Staged* staged, Reader* reader, GCancellable* cancellable, GError** error)
+{
+  Archive* ar = archive_read_new ();
+  gssize read;
+  int result;
+
+  /*
+   * The pack layout is only known once its index (at the end)
+   * is read, so libarchive is left to tell formats apart
+   */
+  archive_read_support_filter_xz (ar);
+  archive_read_support_format_tar (ar);
+  archive_read_support_format_zip_streamable (ar);
+
+  if ((result = archive_read_open2 (ar, reader, NULL, on_teeread, NULL, NULL)), G_UNLIKELY (result != ARCHIVE_OK))
+    report (error, archive_read_open2, ar, reader);
+  else if ((result = walkpack (staged, ar, source, reader, NULL, error)), G_UNLIKELY (result != ARCHIVE_OK))
+    closepack (ar, source, reader, NULL);
+  else
+    {
+      if ((archive_format (ar) & ARCHIVE_FORMAT_BASE_MASK) == ARCHIVE_FORMAT_ZIP)
+        source->layout = LP_PACK_LAYOUT_RANDOM;
+
+      result = closepack (ar, source, reader, error);
+    }
+
+  archive_read_free (ar);
+
+  if (G_UNLIKELY (result != ARCHIVE_OK))
+    return FALSE;
+
+  /* whatever follows the archive proper (the index, if any) */
+  while ((read = g_input_stream_read (source->stream, reader->buffer, reader->buffer_size, cancellable, error)) > 0)
+    if (G_UNLIKELY (lp_anon_file_write (reader->spill, reader->buffer, read, error) == FALSE))
+      return FALSE;
+return read == 0;
+}
+
+static gboolean spillsource (Staged* staged, Source* source, GCancellable* cancellable, GError** error)
+{
+  GMappedFile* mapped = NULL;
+  GBytes* index = NULL;
+  Reader reader = {0};
+  gboolean good;
+
+  /*
+   * A stream which can not be read twice is spilled to a file
+   * while it is scanned (instead of beforehand), which is then
+   * mapped and read from just as a local pack would be
+   */
+  if ((reader.spill = lp_anon_file_new (error)) < 0)
+    return FALSE;
+
+  reader.cancellable = cancellable;
+  reader.stream = source->stream;
+  readerbuffer (&reader, source);
+
+  if ((good = spillpack (source, staged, &reader, cancellable, error)), G_LIKELY (good == TRUE))
+  if ((good = (mapped = g_mapped_file_new_from_fd (reader.spill, FALSE, error)) != NULL), G_LIKELY (good == TRUE))
+    {
+      source->mapped = g_mapped_file_get_bytes (mapped);
+      g_mapped_file_unref (mapped);
+    }
+
+  g_close (reader.spill, NULL);
+  reader_clear (&reader);
+
+  if (G_UNLIKELY (good == FALSE))
+    return FALSE;
+  else if (loadindex (source, &index, error) == FALSE)
+    return FALSE;
+  else if (index != NULL)
+    {
+      /* the index is authoritative (and knows the layout) */
+      dropsource (staged, source);
+      good = walkindex (staged, source, index, error);
+      g_bytes_unref (index);
+    }
+  else if (source->manifest == NULL)
+    {
+      g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_MANIFEST, "missing manifest");
+      good = FALSE;
+    }
+
+  if (G_LIKELY (good == TRUE))
+    probexz (source);
+return good;
+}
+
+static gboolean walksource (Staged* staged, Source* source, GCancellable* cancellable, GError** error)
+{
+  Archive* ar = NULL;
+  GBytes* index = NULL;
+  GHashTable* entries = NULL;
+  Reader reader = {0};
+  Stamp stamp = {0};
+  gchar* cache = NULL;
+  int result;
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return FALSE;
+
+  reader.cancellable = cancellable;
+
+  if (source->type == source_stream && source->mapped == NULL
+    && (G_IS_SEEKABLE (source->stream) == FALSE || g_seekable_can_seek (G_SEEKABLE (source->stream)) == FALSE))
+    return spillsource (staged, source, cancellable, error);
+
+  if (loadindex (source, &index, error) == FALSE)
+    return FALSE;
+  else if (index != NULL)
+    {
+      gboolean good;
+
+      if ((good = walkindex (staged, source, index, error)))
+        probexz (source);
+      return (g_bytes_unref (index), good);
+    }
+
+  if (source->type == source_file && stamppack (source->file, &stamp, NULL))
+    {
+      cache = cachepath (source->file);
+
+      if (loadcache (staged, source, cache, &stamp))
+        {
+          probexz (source);
+          return (g_free (cache), g_free (stamp.digest), TRUE);
+        }
+
+      entries = gvdb_hash_table_new (NULL, NULL);
+    }
+
+  ar = archive_read_new ();
+
+  if ((result = openpack (ar, source, &reader, 0, error)), G_LIKELY (result == ARCHIVE_OK))
+    {
+      if ((result = walkpack (staged, ar, source, &reader, entries, error)), G_UNLIKELY (result != ARCHIVE_OK))
+        closepack (ar, source, &reader, NULL);
+      else
+        {
+          if ((result = closepack (ar, source, &reader, error)), G_LIKELY (result == ARCHIVE_OK))
+          if (source->manifest == NULL)
+            {
+              result = ARCHIVE_FATAL;
+              g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_MANIFEST, "missing manifest");
+            }
+        }
+    }
+
+  if (G_LIKELY (result == ARCHIVE_OK))
+    {
+      probexz (source);
+
+      if (entries != NULL)
+        staged->sidecar = sidecar_new (source, g_steal_pointer (&cache), &stamp, g_steal_pointer (&entries));
+    }
+
+  g_clear_pointer (&entries, g_hash_table_unref);
+  g_free (stamp.digest);
+  g_free (cache);
+  reader_clear (&reader);
+return (archive_read_free (ar), result == ARCHIVE_OK);
+}
+
+static void key_init (Key* key, const gchar* path)
+{
+  gsize size;
+
+  key->heap = NULL;
+
+  if ((key->path = lp_path_normalize (path, key->buffer, sizeof (key->buffer), &key->length, &key->hash)) == NULL)
+    {
+      size = strlen (path) + 1;
+      key->heap = g_malloc (size);
+      key->path = lp_path_normalize (path, key->heap, size, &key->length, &key->hash);
+    }
+}
+
+static void key_clear (Key* key)
+{
+  g_free (key->heap);
+}
+
+static Entry* lookupentry (LpPackReader* self, const Key* key)
+{
+  Entry* entry = NULL;
+
+  g_rw_lock_reader_lock (&self->lock);
+  entry = lp_path_index_lookup (self->vfs, key->path, key->length, key->hash, NULL);
+  g_rw_lock_reader_unlock (&self->lock);
+return entry;
+}
+
+static gboolean hasdir (LpPackReader* self, const Key* key)
+{
+  gboolean has;
+
+  g_rw_lock_reader_lock (&self->lock);
+  has = lp_path_index_lookup (self->dirs, key->path, key->length, key->hash, NULL) != NULL;
+  g_rw_lock_reader_unlock (&self->lock);
+return has;
+}
+
+static Source* newsource (LpPackReader* self, guint type, gpointer arg)
+{
+  Source* source = source_new (type, arg);
+
+  g_mutex_lock (&self->cache_lock);
+  source->buffer_size = self->buffer_size;
+  source->layer = self->layer;
+  g_mutex_unlock (&self->cache_lock);
+return source;
+}
+
+static gboolean stagepack (Staged* staged, Source* source, LpPathIndex* index, GCancellable* cancellable, GError** error)
+{
+  gboolean good;
+
+  staged_init (staged);
+
+  if ((good = walksource (staged, source, cancellable, error)), G_LIKELY (good == TRUE))
+    good = indexstaged (staged, source, index, error);
+return good;
+}
+
+static void queuesidecar (LpPackReader* self, Staged* staged)
+{
+  Sidecar* sidecar = g_steal_pointer (&staged->sidecar);
+  Source* source = NULL;
+  guint64 limit;
+
+  if (sidecar == NULL)
+    return;
+
+  g_mutex_lock (&self->cache_lock);
+  limit = self->recode_limit;
+  g_mutex_unlock (&self->cache_lock);
+
+  /*
+   * A recoded copy takes about as much disk as the pack itself,
+   * so packs are only recoded if asked to (and not too large)
+   */
+  source = sidecar->source;
+  sidecar->recode = source->layout == LP_PACK_LAYOUT_SOLID && source->xzindex == NULL && limit > 0 && sidecar->stamp.size <= limit;
+  sidecar->cancellable = g_object_ref (self->sidecars_cancellable);
+  g_thread_pool_push (self->sidecars, sidecar, NULL);
+}
+
+static gboolean scanpack (LpPackReader* self, Source* source, GCancellable* cancellable, GError** error)
+{
+  LpPathIndex* index = lp_path_index_new ();
+  Staged staged = {0};
+  gboolean good;
+
+  if ((good = stagepack (&staged, source, index, cancellable, error)), G_LIKELY (good == TRUE))
+  if ((good = mergestaged (self, source, staged.paths, index, error)), G_LIKELY (good == TRUE))
+    queuesidecar (self, &staged);
+
+  staged_clear (&staged);
+return (lp_path_index_free (index), good);
+}
+
+static void scanjob (ScanJob* job, gpointer user_data)
+{
+  source_map (job->source);
+  job->good = stagepack (&job->staged, job->source, job->index, NULL, &job->error);
+}
+
+static Cursor* opencursor (Entry* entry, const gchar* path, ArchiveEntry** ent, GCancellable* cancellable, GError** error)
+{
+  Source* source = entry->source;
+  Cursor* cursor = NULL;
+  gboolean seekable = source->layout != LP_PACK_LAYOUT_SOLID || source->xzindex != NULL;
+  goffset offset = seekable ? entry->offset : 0;
+  int result;
+
+  g_mutex_lock (&source->lock);
+  cursor = g_steal_pointer (&source->cursor);
+  g_mutex_unlock (&source->lock);
+
+  /*
+   * A parked cursor is only useful if @entry lies ahead of it, and
+   * (when the pack can be seeked into) not past the current block
+   */
+  if (cursor != NULL && (cursor->offset >= entry->offset || (seekable && entry->offset - cursor->offset >= LP_PACK_BLOCK_SIZE)))
+    {
+      closepack (cursor->ar, source, &cursor->reader, NULL);
+      g_clear_pointer (&cursor, cursor_free);
+    }
+
+  if (cursor == NULL)
+    {
+      cursor = cursor_new ();
+      cursor->base = offset;
+      cursor->reader.cancellable = cancellable;
+
+      if ((result = openpack (cursor->ar, source, &cursor->reader, offset, error)), G_UNLIKELY (result != ARCHIVE_OK))
+        return (cursor_free (cursor), NULL);
+    }
+
+  /* @cancellable is only borrowed while walking up to @entry */
+  cursor->reader.cancellable = cancellable;
+
+  while (TRUE)
+    {
+      if (G_UNLIKELY (g_cancellable_set_error_if_cancelled (cancellable, error)))
+        {
+          closepack (cursor->ar, source, &cursor->reader, NULL);
+          return (cursor_free (cursor), NULL);
+        }
+      else if ((result = archive_read_next_header (cursor->ar, ent)), G_UNLIKELY (result != ARCHIVE_OK))
+        {
+          report (error, archive_read_next_header, cursor->ar, &cursor->reader);
+          closepack (cursor->ar, source, &cursor->reader, NULL);
+          return (cursor_free (cursor), NULL);
+        }
+      else
+        {
+          const gchar* pathname = archive_entry_pathname_utf8 (*ent);
+
+          if (g_strcmp0 (path, pathname) == 0)
+            break;
+        }
+    }
+  cursor->reader.cancellable = NULL;
+return (cursor->offset = cursor->base + archive_read_header_position (cursor->ar), cursor);
+}
+
+static GBytes* readentry (Cursor* cursor, ArchiveEntry* ent, GError** error)
+{
+  const gboolean known = archive_entry_size_is_set (ent);
+  gsize size = known ? (gsize) archive_entry_size (ent) : 4096;
+  gchar* data = g_malloc (size);
+  la_ssize_t result;
+  gsize done = 0;
+
+  while (TRUE)
+    {
+      if (G_UNLIKELY (done == size))
+        {
+          if (known)
+            break;
+
+          data = g_realloc (data, size <<= 1);
+        }
+
+      if ((result = archive_read_data (cursor->ar, data + done, size - done)), G_UNLIKELY (result < 0))
+        {
+          report (error, archive_read_data, cursor->ar, &cursor->reader);
+          g_free (data);
+          return NULL;
+        }
+      else if (result == 0)
+        {
+          if (G_LIKELY (known == FALSE))
+            break;
+
+          g_set_error_literal (error, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_OPEN, "truncated entry");
+          g_free (data);
+          return NULL;
+        }
+
+      done += result;
+    }
+return g_bytes_new_take (data, done);
+}
+
+static GBytes* takebytes (Entry* entry, Cursor* cursor, ArchiveEntry* ent, GError** error)
+{
+  GBytes* bytes = NULL;
+
+  if ((bytes = readentry (cursor, ent, error)), G_UNLIKELY (bytes == NULL))
+    {
+      closepack (cursor->ar, entry->source, &cursor->reader, NULL);
+      cursor_free (cursor);
+    }
+  else if (G_UNLIKELY (parkcursor (entry->source, cursor, error) == FALSE))
+    g_clear_pointer (&bytes, g_bytes_unref);
+return bytes;
+}
+
+static inline guint16 readle16 (const guint8* data)
+{
+  return (guint16) data [0] | ((guint16) data [1] << 8);
+}
+
+static GBytes* storedbytes (Entry* entry)
+{
+  Source* source = entry->source;
+  GBytes* bytes = source_get_bytes (source);
+  const guint8* data = NULL;
+  gsize length, start;
+
+  if (source->layout != LP_PACK_LAYOUT_STORED || bytes == NULL || entry->size < 0)
+    return NULL;
+
+  data = g_bytes_get_data (bytes, &length);
+  length = source->length < 0 ? length : MIN (length, (gsize) source->length);
+
+  /*
+   * ZIP local file header (see APPNOTE.TXT section 4.3.7), data
+   * follows it right after file name and extra field
+   */
+  if ((gsize) entry->offset > length || length - entry->offset < 30)
+    return NULL;
+  else if (memcmp (data + entry->offset, "PK\3\4", 4) != 0)
+    return NULL;
+  else if ((readle16 (data + entry->offset + 6) & 1) != 0 || readle16 (data + entry->offset + 8) != 0)
+    return NULL;
+
+  start = entry->offset + 30 + readle16 (data + entry->offset + 26) + readle16 (data + entry->offset + 28);
+
+  if (start > length || length - start < (gsize) entry->size)
+    return NULL;
+return g_bytes_new_from_bytes (bytes, start, entry->size);
+}
+
+static guint64 cachebudget (LpPackReader* self)
+{
+  guint64 budget;
+
+  g_mutex_lock (&self->cache_lock);
+  budget = self->cache_budget;
+  g_mutex_unlock (&self->cache_lock);
+return budget;
+}
+
+static GBytes* entrybytes (LpPackReader* self, Entry* entry, const gchar* path, GError** error)
+{
+  const guint64 budget = cachebudget (self);
+  ArchiveEntry* ent = NULL;
+  Cursor* cursor = NULL;
+  GBytes* bytes = NULL;
+
+  if ((bytes = storedbytes (entry)) == NULL
+    && (budget == 0 || (bytes = cachelookup (self, entry)) == NULL))
+    {
+      if ((cursor = opencursor (entry, path, &ent, NULL, error)), G_LIKELY (cursor != NULL))
+      if ((bytes = takebytes (entry, cursor, ent, error)), G_LIKELY (bytes != NULL))
+      if (budget > 0 && g_bytes_get_size (bytes) <= budget)
+        cacheinsert (self, entry, bytes);
+    }
+return bytes;
+}
+
+static void batchcollect (const gchar* path, gpointer value, gpointer user_data)
+{
+  BatchItem item = { .path = path, .entry = value, };
+  g_array_append_val ((GArray*) user_data, item);
+}
+
+static gint batchitem_cmp (const BatchItem* item_a, const BatchItem* item_b)
+{
+  const Entry* entry_a = item_a->entry;
+  const Entry* entry_b = item_b->entry;
+
+  if (entry_a->source != entry_b->source)
+    return entry_a->source < entry_b->source ? -1 : 1;
+  else if (entry_a->offset != entry_b->offset)
+    return entry_a->offset < entry_b->offset ? -1 : 1;
+return 0;
+}
+
+static gboolean batchrun (LpPackReader* self, GArray* items, LpPackReaderForeachFunc func, gpointer user_data, GError** error)
+{
+  GBytes* bytes = NULL;
+  gboolean good = TRUE;
+  guint i;
+
+  /*
+   * Entries are visited grouped by source and in archive order, so
+   * opencursor always finds the cursor parked by the previous entry
+   * right behind the next one and each source is read in one pass
+   */
+  g_array_sort (items, (GCompareFunc) batchitem_cmp);
+
+  for (i = 0; i < items->len; ++i)
+    {
+      BatchItem* item = & g_array_index (items, BatchItem, i);
+
+      if ((bytes = entrybytes (self, item->entry, item->path, error)), G_UNLIKELY (bytes == NULL))
+        {
+          good = FALSE;
+          break;
+        }
+      else
+        {
+          gboolean more = func (item->path, bytes, user_data);
+
+          g_bytes_unref (bytes);
+
+          if (more == FALSE)
+            break;
+        }
+    }
+return good;
+}
+
+static GInputStream* openentry (LpPackReader* self, const gchar* path, GCancellable* cancellable, GError** error)
+{
+  GInputStream* stream = NULL;
+  ArchiveEntry* ent = NULL;
+  Cursor* cursor = NULL;
+  GBytes* bytes = NULL;
+  Entry* entry = NULL;
+  guint64 budget;
+  guint read_ahead;
+  Key key;
+
+  g_mutex_lock (&self->cache_lock);
+  budget = self->cache_budget;
+  read_ahead = self->read_ahead;
+  g_mutex_unlock (&self->cache_lock);
+
+  key_init (&key, path);
+
+  if ((entry = lookupentry (self, &key)), G_UNLIKELY (entry == NULL))
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "path '%s' not found", path);
+  else if ((bytes = storedbytes (entry)) != NULL)
+    stream = g_memory_input_stream_new_from_bytes (bytes);
+  else if (budget > 0 && (bytes = cachelookup (self, entry)) != NULL)
+    stream = g_memory_input_stream_new_from_bytes (bytes);
+  else if ((cursor = opencursor (entry, key.path, &ent, cancellable, error)), G_LIKELY (cursor != NULL))
+    {
+      const guint64 size = (guint64) archive_entry_size (ent);
+
+      if (budget > 0 && archive_entry_size_is_set (ent) && size <= budget)
+        {
+          if ((bytes = takebytes (entry, cursor, ent, error)), G_LIKELY (bytes != NULL))
+            {
+              cacheinsert (self, entry, bytes);
+              stream = g_memory_input_stream_new_from_bytes (bytes);
+            }
+        }
+      else
+        {
+          LpPackReaderStream* pstream = g_object_new (lp_pack_reader_stream_get_type (), NULL);
+
+          pstream->cursor = cursor;
+          pstream->entry = entry_ref (entry);
+          pstream->path = g_strdup (key.path);
+          stream = G_INPUT_STREAM (pstream);
+
+          /*
+           * Tar entry data is stored contiguously right after its
+           * header (unless sparse), which is where libarchive just
+           * stopped consuming the uncompressed stream
+           */
+          if (entry->source->xzindex != NULL && entry->size >= 0 && archive_entry_sparse_count (ent) == 0)
+            pstream->data = cursor->base + archive_filter_bytes (cursor->ar, 0);
+
+          if (read_ahead > 0)
+            lp_pack_reader_stream_start (pstream, read_ahead);
+        }
+    }
+
+  g_clear_pointer (&bytes, g_bytes_unref);
+return (key_clear (&key), stream);
+}
+
+static void addthread (GTask* task, gpointer pself, gpointer source, GCancellable* cancellable)
+{
+  GError* tmperr = NULL;
+
+  if ((source_map (source), scanpack (pself, source, cancellable, &tmperr)))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, tmperr);
+}
+
+static void openthread (GTask* task, gpointer pself, gpointer path, GCancellable* cancellable)
+{
+  GInputStream* stream = NULL;
+  GError* tmperr = NULL;
+
+  if ((stream = openentry (pself, path, cancellable, &tmperr)), G_LIKELY (stream != NULL))
+    g_task_return_pointer (task, stream, g_object_unref);
+  else
+    g_task_return_error (task, tmperr);
+}
+
+/**
+ * lp_pack_reader_add_from_bytes:
+ * @reader: #LpPackReader instance.
+ * @bytes: data to be added into @reader output.
+ * @error: return location for a #GError, or %NULL.
+ * 
+ * Adds data contained in @bytes into @reader under @path.
+ * The pack goes into the layer set in #LpPackReader:layer when
+ * this is called: its paths shadow those of packs on lower (or
+ * the same) layers and are shadowed by those on higher ones.
+ * Directory listings include paths from every layer. Packs with
+ * a file where another has a directory (or the other way around)
+ * are refused with %LP_PACK_READER_ERROR_SCAN.
+ * 
+ * Returns: if operation was successful.
+*/
+gboolean lp_pack_reader_add_from_bytes (LpPackReader* reader, GBytes* bytes, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), FALSE);
+  g_return_val_if_fail (bytes != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  LpPackReader* self = (reader);
+  Source* source = newsource (self, source_bytes, bytes);
+  gboolean good = scanpack (self, source, NULL, error);
+return (source_unref (source), good);
+}
+
+/**
+ * lp_pack_reader_add_from_file:
+ * @reader: #LpPackReader instance.
+ * @file: #GFile instance.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Adds data from file pointed by @file into @reader under @path.
+ * Packs without an index are indexed once and the result cached
+ * in the background; single block solid packs no larger than
+ * #LpPackReader:recode-limit are also recoded there, so later
+ * scans can seek into them.
+ * 
+ * Returns: if operation was successful.
+*/
+gboolean lp_pack_reader_add_from_file (LpPackReader* reader, GFile* file, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), FALSE);
+  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  LpPackReader* self = (reader);
+  Source* source = newsource (self, source_file, file);
+  gboolean good = (source_map (source), scanpack (self, source, NULL, error));
+return (source_unref (source), good);
+}
+
+/**
+ * lp_pack_reader_add_from_file_async:
+ * @reader: #LpPackReader instance.
+ * @file: #GFile instance.
+ * @io_priority: the I/O priority of the request.
+ * @cancellable: (nullable): optional #GCancellable object, %NULL to ignore.
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the request is satisfied.
+ * @user_data: (closure): the data to pass to callback function.
+ *
+ * Asynchronously adds data from file pointed by @file into @reader.
+ * The pack is scanned in a worker thread, and its entries only
+ * become visible once scanning completes, so a cancelled call
+ * leaves @reader untouched. See #lp_pack_reader_add_from_file for
+ * the synchronous version of this call.
+*/
+void lp_pack_reader_add_from_file_async (LpPackReader* reader, GFile* file, int io_priority, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+  g_return_if_fail (LP_IS_PACK_READER (reader));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  GTask* task = g_task_new (reader, cancellable, callback, user_data);
+
+  g_task_set_priority (task, io_priority);
+  g_task_set_source_tag (task, lp_pack_reader_add_from_file_async);
+  g_task_set_task_data (task, newsource (reader, source_file, file), (GDestroyNotify) source_unref);
+  g_task_run_in_thread (task, addthread);
+  g_object_unref (task);
+}
+
+/**
+ * lp_pack_reader_add_from_file_finish:
  * @reader: #LpPackReader instance.
- * @bytes: data to be added into @reader output.
+ * @result: a #GAsyncResult.
  * @error: return location for a #GError, or %NULL.
- * 
- * Adds data contained in @bytes into @reader under @path.
- * 
+ *
+ * Finishes an operation started with #lp_pack_reader_add_from_file_async.
+ *
  * Returns: if operation was successful.
 */
-gboolean lp_pack_reader_add_from_bytes (LpPackReader* reader, GBytes* bytes, GError** error)
+gboolean lp_pack_reader_add_from_file_finish (LpPackReader* reader, GAsyncResult* result, GError** error)
 {
   g_return_val_if_fail (LP_IS_PACK_READER (reader), FALSE);
-  g_return_val_if_fail (bytes != NULL, FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, reader), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
-  LpPackReader* self = (reader);
-  Source* source = source_new (source_bytes, bytes);
-  gboolean good = scanpack (self, source, error);
-return (source_unref (source), good);
+return g_task_propagate_boolean (G_TASK (result), error);
 }
 
 /**
- * lp_pack_reader_add_from_file:
+ * lp_pack_reader_add_from_files:
  * @reader: #LpPackReader instance.
- * @file: #GFile instance.
+ * @files: (array length=n_files): #GFile instances.
+ * @n_files: length of @files.
  * @error: return location for a #GError, or %NULL.
  *
- * Adds data from file pointed by @file into @reader under @path.
- * 
+ * Adds data from every file in @files into @reader, as calling
+ * #lp_pack_reader_add_from_file on each of them (in order, until
+ * one fails) would, but scanning them concurrently on a worker
+ * pool. Packs are only merged into @reader once every scan ended,
+ * in @files order, so the outcome does not depend on which scan
+ * finishes first: later files shadow earlier ones on the same
+ * layer, and the error reported is the one of the first file
+ * which failed (files after it are not added).
+ *
  * Returns: if operation was successful.
 */
-gboolean lp_pack_reader_add_from_file (LpPackReader* reader, GFile* file, GError** error)
+gboolean lp_pack_reader_add_from_files (LpPackReader* reader, GFile** files, guint n_files, GError** error)
 {
   g_return_val_if_fail (LP_IS_PACK_READER (reader), FALSE);
-  g_return_val_if_fail (G_IS_FILE (file), FALSE);
+  g_return_val_if_fail (files != NULL || n_files == 0, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
   LpPackReader* self = (reader);
-  Source* source = source_new (source_file, file);
-  gboolean good = scanpack (self, source, error);
-return (source_unref (source), good);
+  const guint threads = MIN (n_files, g_get_num_processors ());
+  GThreadPool* pool = NULL;
+  ScanJob* jobs = NULL;
+  gboolean good = TRUE;
+  guint i;
+
+  for (i = 0; i < n_files; ++i)
+    g_return_val_if_fail (G_IS_FILE (files [i]), FALSE);
+
+  if (n_files == 0)
+    return TRUE;
+
+  jobs = g_new0 (ScanJob, n_files);
+  pool = g_thread_pool_new ((GFunc) scanjob, NULL, (gint) threads, FALSE, NULL);
+
+  for (i = 0; i < n_files; ++i)
+    {
+      jobs [i].source = newsource (self, source_file, files [i]);
+      jobs [i].index = lp_path_index_new ();
+      g_thread_pool_push (pool, jobs + i, NULL);
+    }
+
+  g_thread_pool_free (pool, FALSE, TRUE);
+
+  for (i = 0; i < n_files; ++i)
+    {
+      ScanJob* job = jobs + i;
+
+      if (good)
+        {
+          if ((good = job->good) == FALSE)
+            g_propagate_error (error, g_steal_pointer (&job->error));
+          else if ((good = mergestaged (self, job->source, job->staged.paths, job->index, error)))
+            queuesidecar (self, &job->staged);
+        }
+
+      g_clear_error (&job->error);
+      staged_clear (&job->staged);
+      lp_path_index_free (job->index);
+      source_unref (job->source);
+    }
+return (g_free (jobs), good);
 }
 
 /**
@@ -278,8 +2542,10 @@ return (g_object_unref (file), good);
  * @error: return location for a #GError, or %NULL.
  *
  * Similar to #lp_pack_reader_add_from_bytes, but takes an
- * #GInputStream instead of #GBytes. Upon output data from
- * @stream will be spliced.
+ * #GInputStream instead of #GBytes. A seekable @stream is kept
+ * and read from on demand. Otherwise @stream is consumed once,
+ * being spilled (as it is scanned) into an anonymous file, which
+ * backs later reads.
  * 
  * Returns: if operation was successful.
 */
@@ -289,50 +2555,273 @@ gboolean lp_pack_reader_add_from_stream (LpPackReader* reader, GInputStream* str
   g_return_val_if_fail (G_IS_INPUT_STREAM (stream), FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
   LpPackReader* self = (reader);
+  Source* source = newsource (self, source_stream, stream);
+  gboolean good = scanpack (self, source, NULL, error);
+return (source_unref (source), good);
+}
 
-  if (G_IS_SEEKABLE (stream) && g_seekable_can_seek (G_SEEKABLE (stream)))
+/**
+ * lp_pack_reader_contains:
+ * @reader: #LpPackReader instance.
+ * @path: path to look up in @reader.
+ * 
+ * Returns: whether @reader contains @path.
+*/
+gboolean lp_pack_reader_contains (LpPackReader* reader, const gchar* path)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+  LpPackReader* self = (reader);
+  gboolean has;
+  Key key;
+
+  key_init (&key, path);
+  has = lookupentry (self, &key) != NULL;
+return (key_clear (&key), has);
+}
+
+static gchar** listchildren (Dir* dir, gsize skip)
+{
+  GPtrArray* names = g_ptr_array_sized_new (dir->children->len + 1);
+  guint i;
+
+  for (i = 0; i < dir->children->len; ++i)
+    {
+      Child* child = & g_array_index (dir->children, Child, i);
+      g_ptr_array_add (names, g_strndup (child->path + skip, child->length - skip));
+    }
+return (g_ptr_array_add (names, NULL), (gchar**) g_ptr_array_free (names, FALSE));
+}
+
+static void listfiles (Dir* dir, GPtrArray* paths)
+{
+  guint i;
+
+  for (i = 0; i < dir->children->len; ++i)
     {
-      /* Resetable stream */
-      Source* source = source_new (source_stream, stream);
-      gboolean good = scanpack (self, source, error);
-      return (source_unref (source), good);
+      Child* child = & g_array_index (dir->children, Child, i);
+
+      if (child->dir != NULL)
+        listfiles (child->dir, paths);
+      else
+        g_ptr_array_add (paths, g_strndup (child->path, child->length));
     }
+}
+
+static Dir* lookupdir (LpPackReader* self, const Key* key, const gchar* path, GError** error)
+{
+  Dir* dir = NULL;
+
+  if ((dir = lp_path_index_lookup (self->dirs, key->path, key->length, key->hash, NULL)) != NULL)
+    return dir;
+  else if (lp_path_index_lookup (self->vfs, key->path, key->length, key->hash, NULL) != NULL)
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY, "path '%s' is not a directory", path);
   else
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "path '%s' not found", path);
+return NULL;
+}
+
+/**
+ * lp_pack_reader_enumerate_children:
+ * @reader: #LpPackReader instance.
+ * @path: directory to list.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Lists the names of files and directories right under directory
+ * @path, sorted. Directories need not be packed themselves, any
+ * path prefix some packed file lies under is one ("/" is always
+ * one). Listings are built when packs are added, so this takes
+ * time proportional to the number of children only.
+ *
+ * Returns: (transfer full) (array zero-terminated=1): names of
+ * the children of @path.
+*/
+gchar** lp_pack_reader_enumerate_children (LpPackReader* reader, const gchar* path, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+  LpPackReader* self = (reader);
+  gchar** names = NULL;
+  Dir* dir = NULL;
+  Key key;
+
+  key_init (&key, path);
+  g_rw_lock_reader_lock (&self->lock);
+
+  if ((dir = lookupdir (self, &key, path, error)) != NULL)
+    names = listchildren (dir, key.length > 0 ? key.length + 1 : 0);
+
+  g_rw_lock_reader_unlock (&self->lock);
+return (key_clear (&key), names);
+}
+
+/**
+ * lp_pack_reader_enumerate_prefix:
+ * @reader: #LpPackReader instance.
+ * @path: directory to walk.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Lists every packed file under directory @path, at any depth,
+ * sorted component by component. See #lp_pack_reader_enumerate_children
+ * for what a directory is.
+ *
+ * Returns: (transfer full) (array zero-terminated=1): paths of
+ * every file under @path, as they would be passed to
+ * #lp_pack_reader_open.
+*/
+gchar** lp_pack_reader_enumerate_prefix (LpPackReader* reader, const gchar* path, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+  LpPackReader* self = (reader);
+  GPtrArray* paths = NULL;
+  Dir* dir = NULL;
+  Key key;
+
+  key_init (&key, path);
+  g_rw_lock_reader_lock (&self->lock);
+
+  if ((dir = lookupdir (self, &key, path, error)) != NULL)
     {
-      /* No resetable stream, dump it to bytes */
-      GBytes* bytes;
-      GOutputStream* target = g_memory_output_stream_new_resizable ();
-      GOutputStreamSpliceFlags flags = G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET;
-      gboolean good = g_output_stream_splice (target, stream, flags, NULL, error);
+      paths = g_ptr_array_new ();
+      listfiles (dir, paths);
+      g_ptr_array_add (paths, NULL);
+    }
 
-      if (good)
+  g_rw_lock_reader_unlock (&self->lock);
+return (key_clear (&key), paths == NULL ? NULL : (gchar**) g_ptr_array_free (paths, FALSE));
+}
+
+/**
+ * lp_pack_reader_extract_many:
+ * @reader: #LpPackReader instance.
+ * @paths: (array zero-terminated=1): paths to extract from @reader.
+ * @func: (scope call) (closure user_data): function to call for each path.
+ * @user_data: (nullable): data to pass to @func.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Extracts every path in @paths and passes its contents to @func.
+ * Unlike calling #lp_pack_reader_lookup_bytes for each of them,
+ * paths are visited in archive order so every pack involved is
+ * decompressed at most once. Order in @paths is not preserved.
+ * If @func returns %FALSE extraction stops early.
+ *
+ * Returns: if operation was successful.
+*/
+gboolean lp_pack_reader_extract_many (LpPackReader* reader, const gchar* const* paths, LpPackReaderForeachFunc func, gpointer user_data, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), FALSE);
+  g_return_val_if_fail (paths != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  LpPackReader* self = (reader);
+  GArray* items = g_array_new (FALSE, FALSE, sizeof (BatchItem));
+  gboolean good = TRUE;
+  guint i;
+  Key key;
+
+  g_rw_lock_reader_lock (&self->lock);
+
+  for (i = 0; paths [i] != NULL; ++i)
+    {
+      BatchItem item = {0};
+
+      key_init (&key, paths [i]);
+
+      if ((item.entry = lp_path_index_lookup (self->vfs, key.path, key.length, key.hash, &item.path)), G_UNLIKELY (item.entry == NULL))
         {
-          bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (target));
-          good = lp_pack_reader_add_from_bytes (self, bytes, error);
-                  g_bytes_unref (bytes);
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "path '%s' not found", paths [i]);
+          key_clear (&key);
+          good = FALSE;
+          break;
         }
 
-      return (g_object_unref (target), good);
+      g_array_append_val (items, item);
+      key_clear (&key);
     }
+
+  g_rw_lock_reader_unlock (&self->lock);
+
+  if (G_LIKELY (good == TRUE))
+    good = batchrun (self, items, func, user_data, error);
+return (g_array_unref (items), good);
 }
 
 /**
- * lp_pack_reader_contains:
+ * lp_pack_reader_foreach:
  * @reader: #LpPackReader instance.
- * @path: path to look up in @reader.
- * 
- * Returns: whether @reader contains @path.
+ * @filter: (nullable) (scope call) (closure user_data): function selecting which paths to visit.
+ * @func: (scope call) (closure user_data): function to call for each selected path.
+ * @user_data: (nullable): data to pass to @filter and @func.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Passes the contents of every packed file for which @filter returns
+ * %TRUE (or of every packed file, if @filter is %NULL) to @func. Files
+ * are visited in archive order, so every pack is decompressed at most
+ * once. If @func returns %FALSE the walk stops early.
+ *
+ * Returns: if operation was successful.
 */
-gboolean lp_pack_reader_contains (LpPackReader* reader, const gchar* path)
+gboolean lp_pack_reader_foreach (LpPackReader* reader, LpPackReaderFilterFunc filter, LpPackReaderForeachFunc func, gpointer user_data, GError** error)
 {
   g_return_val_if_fail (LP_IS_PACK_READER (reader), FALSE);
-  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+  LpPackReader* self = (reader);
+  GArray* items = g_array_new (FALSE, FALSE, sizeof (BatchItem));
+  gboolean good;
+  guint i, j;
+
+  g_rw_lock_reader_lock (&self->lock);
+  lp_path_index_foreach (self->vfs, batchcollect, items);
+  g_rw_lock_reader_unlock (&self->lock);
+
+  /* @filter is called unlocked, so it may use @reader itself */
+  for (i = 0, j = 0; i < items->len; ++i)
+    {
+      BatchItem* item = & g_array_index (items, BatchItem, i);
+
+      if (filter == NULL || filter (item->path, user_data))
+        g_array_index (items, BatchItem, j++) = *item;
+    }
+
+  g_array_set_size (items, j);
+  good = batchrun (self, items, func, user_data, error);
+return (g_array_unref (items), good);
+}
+
+/**
+ * lp_pack_reader_lookup_bytes:
+ * @reader: #LpPackReader instance.
+ * @path: path to look up in @reader.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Looks up packed file @path and returns its whole contents. Entries
+ * of mapped (or in-memory) stored packs are returned as a slice of
+ * the pack data without copying, any other entry is decompressed
+ * into a single allocation of its exact size.
+ *
+ * Returns: (transfer full): contents of @path.
+*/
+GBytes* lp_pack_reader_lookup_bytes (LpPackReader* reader, const gchar* path, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
   LpPackReader* self = (reader);
-  gchar* canon = (gchar*) g_canonicalize_filename (path, "/");
-  gchar* value = (gchar*) g_path_skip_root (canon);
-  File file = { .path = value, .hash = g_str_hash (value), };
-  gboolean has = g_tree_lookup_extended (self->vfs, &file, NULL, NULL);
-return (g_free (canon), has);
+  GBytes* bytes = NULL;
+  Entry* entry = NULL;
+  Key key;
+
+  key_init (&key, path);
+
+  if ((entry = lookupentry (self, &key)), G_UNLIKELY (entry == NULL))
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "path '%s' not found", path);
+  else
+    bytes = entrybytes (self, entry, key.path, error);
+return (key_clear (&key), bytes);
 }
 
 /**
@@ -353,7 +2842,13 @@ LpPackReader* lp_pack_reader_new ()
  * @path: path to look up in @reader.
  * @error: return location for a #GError, or %NULL.
  * 
- * Opens packed file @path
+ * Opens packed file @path. If #LpPackReader:cache-budget is non-zero,
+ * entries fitting into it are decompressed whole and kept in a LRU
+ * cache, so later opens of the same path are served from memory.
+ * Otherwise, if #LpPackReader:read-ahead is non-zero, the returned
+ * stream decompresses up to that many chunks ahead of the caller
+ * in a background thread, and is pollable (so its asynchronous
+ * reads need no extra thread either).
  * 
  * Returns: (transfer full): a #GInputStream where to read @path.
 */
@@ -362,58 +2857,53 @@ GInputStream* lp_pack_reader_open (LpPackReader* reader, const gchar* path, GErr
   g_return_val_if_fail (LP_IS_PACK_READER (reader), NULL);
   g_return_val_if_fail (path != NULL, NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
-  LpPackReader* self = (reader);
-  gchar* canon = (gchar*) g_canonicalize_filename (path, "/");
-  gchar* value = (gchar*) g_path_skip_root (canon);
-  File file = { .path = value, .hash = g_str_hash (value), };
-  Source* source = g_tree_lookup (self->vfs, &file);
-  LpPackReaderStream* stream = NULL;
-  int result;
-
-  if (G_UNLIKELY (source == NULL))
-    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "path '%s' not found", path);
-  else
-    {
-      stream = g_object_new (lp_pack_reader_stream_get_type (), NULL);
-      stream->ar = archive_read_new ();
-      stream->source = source_ref (source);
-
-      if ((result = openpack (stream->ar, stream->source, &stream->reader, error)), G_UNLIKELY (result != ARCHIVE_OK))
-        {
-          g_input_stream_close ((GInputStream*) stream, NULL, NULL);
-          g_clear_object (&stream);
-        }
-      else
-        {
-          ArchiveEntry* ent = NULL;
+return openentry (reader, path, NULL, error);
+}
 
-          while (TRUE)
-            {
-              if ((result = archive_read_next_header (stream->ar, &ent)), G_UNLIKELY (result != ARCHIVE_OK))
-                {
-                  report (error, archive_read_next_header, stream->ar, &stream->reader);
-                  break;
-                }
-              else if (G_UNLIKELY (result == ARCHIVE_EOF))
-                g_assert_not_reached ();
-              else
-                {
-                  const gchar* pathname = archive_entry_pathname_utf8 (ent);
-                  File file2 = { .path = (gchar*) pathname, .hash = g_str_hash (pathname), };
+/**
+ * lp_pack_reader_open_async:
+ * @reader: #LpPackReader instance.
+ * @path: path to look up in @reader.
+ * @io_priority: the I/O priority of the request.
+ * @cancellable: (nullable): optional #GCancellable object, %NULL to ignore.
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the request is satisfied.
+ * @user_data: (closure): the data to pass to callback function.
+ *
+ * Asynchronously opens packed file @path. Walking up to the entry
+ * (and decompressing it, if it ends in the cache) happens in a
+ * worker thread. See #lp_pack_reader_open for the synchronous
+ * version of this call.
+*/
+void lp_pack_reader_open_async (LpPackReader* reader, const gchar* path, int io_priority, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+  g_return_if_fail (LP_IS_PACK_READER (reader));
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  GTask* task = g_task_new (reader, cancellable, callback, user_data);
 
-                  if (file_cmp (&file, &file2) == 0)
-                    break;
-                }
-            }
+  g_task_set_priority (task, io_priority);
+  g_task_set_source_tag (task, lp_pack_reader_open_async);
+  g_task_set_task_data (task, g_strdup (path), g_free);
+  g_task_run_in_thread (task, openthread);
+  g_object_unref (task);
+}
 
-          if (G_UNLIKELY (result != ARCHIVE_OK))
-            {
-              g_input_stream_close ((GInputStream*) stream, NULL, NULL);
-              g_clear_object (&stream);
-            }
-        }
-    }
-return (GInputStream*) stream;
+/**
+ * lp_pack_reader_open_finish:
+ * @reader: #LpPackReader instance.
+ * @result: a #GAsyncResult.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Finishes an operation started with #lp_pack_reader_open_async.
+ *
+ * Returns: (transfer full): a #GInputStream where to read @path.
+*/
+GInputStream* lp_pack_reader_open_finish (LpPackReader* reader, GAsyncResult* result, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, reader), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+return g_task_propagate_pointer (G_TASK (result), error);
 }
 
 /**
@@ -423,7 +2913,10 @@ return (GInputStream*) stream;
  * @attributes: an attribute query string.
  * @error: return location for a #GError, or %NULL.
  *
- * Queries info about @path.
+ * Queries info about @path. Only metadata recorded when
+ * the pack was added is reported, so no I/O is involved.
+ * Directories which were not packed themselves (see
+ * #lp_pack_reader_enumerate_children) are reported too.
  *
  * Returns: (transfer full): a #GFileInfo containig info about @path.
  */
@@ -434,127 +2927,153 @@ GFileInfo* lp_pack_reader_query_info (LpPackReader* reader, const gchar* path, c
   g_return_val_if_fail (attributes != NULL, NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
   LpPackReader* self = (reader);
-  gchar* canon = (gchar*) g_canonicalize_filename (path, "/");
-  gchar* value = (gchar*) g_path_skip_root (canon);
-  File file = { .path = value, .hash = g_str_hash (value), };
-  Source* source = g_tree_lookup (self->vfs, &file);
+  const Times* times = NULL;
   GFileInfo* info = NULL;
-  int result;
+  Entry* entry = NULL;
+  Key key;
 
-  if (G_UNLIKELY (source == NULL))
+  key_init (&key, path);
+
+  if ((entry = lookupentry (self, &key)) == NULL && G_UNLIKELY (hasdir (self, &key) == FALSE))
     g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND, "path '%s' not found", path);
   else
     {
-      Archive* ar = NULL;
-      ArchiveEntry* ent = NULL;
-      Reader reader = {0};
+      GFileAttributeMatcher* matcher = NULL;
+      GFileType type = G_FILE_TYPE_DIRECTORY;
+      gchar* basename = NULL;
 
-      if ((result = openpack (ar = archive_read_new (), source, &reader, error)), G_LIKELY (result == ARCHIVE_OK))
+      if (entry != NULL)
         {
-          while (TRUE)
-            {
-              if ((result = archive_read_next_header (ar, &ent)), G_UNLIKELY (result != ARCHIVE_OK))
-                {
-                  report (error, archive_read_next_header, ar, &reader);
-                  break;
-                }
-              else if (G_UNLIKELY (result == ARCHIVE_EOF))
-                g_assert_not_reached ();
-              else
-                {
-                  const gchar* pathname = archive_entry_pathname_utf8 (ent);
-                  File file2 = { .path = (gchar*) pathname, .hash = g_str_hash (pathname), };
+          type = S_ISDIR (entry->mode) ? G_FILE_TYPE_DIRECTORY : S_ISLNK (entry->mode) ? G_FILE_TYPE_SYMBOLIC_LINK : G_FILE_TYPE_REGULAR;
+          times = entry_times (entry);
+        }
 
-                  if (file_cmp (&file, &file2) == 0)
-                    break;
-                }
-            }
+      matcher = g_file_attribute_matcher_new (attributes);
+      basename = key.length == 0 ? g_strdup ("/") : g_path_get_basename (key.path);
+      info = g_file_info_new ();
 
-          if (G_UNLIKELY (result != ARCHIVE_OK))
-            closepack (ar, source, &reader, NULL);
-          else
-            {
-              GFileAttributeMatcher* matcher = NULL;
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_TYPE))
+        g_file_info_set_file_type (info, type);
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN))
+        g_file_info_set_is_hidden (info, FALSE);
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_NAME))
+        g_file_info_set_name (info, basename);
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME))
+        g_file_info_set_display_name (info, basename);
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_EDIT_NAME))
+        g_file_info_set_edit_name (info, basename);
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_COPY_NAME))
+        g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_COPY_NAME, basename);
 
-              matcher = g_file_attribute_matcher_new (attributes);
-              info = g_file_info_new ();
+      /* content types are guessed from names only, as sniffing would take I/O */
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE)
+       || g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE))
+        {
+          gchar* content_type = type == G_FILE_TYPE_DIRECTORY ? g_strdup ("inode/directory") : g_content_type_guess (basename, NULL, 0, NULL);
 
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_TYPE))
-                g_file_info_set_file_type (info, G_FILE_TYPE_REGULAR);
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN))
-                g_file_info_set_is_hidden (info, FALSE);
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_NAME))
-                {
-                  gchar* pathname = (gchar*) archive_entry_pathname (ent);
-                  gchar* basename = (gchar*) g_path_get_basename (pathname);
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE))
+            g_file_info_set_content_type (info, content_type);
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE))
+            g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_FAST_CONTENT_TYPE, content_type);
 
-                  g_file_info_set_name (info, basename);
-                  g_free (basename);
-                }
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME))
-                {
-                  gchar* pathname = (gchar*) archive_entry_pathname_utf8 (ent);
-                  gchar* basename = (gchar*) g_path_get_basename (pathname);
+          g_free (content_type);
+        }
 
-                  g_file_info_set_display_name (info, basename);
-                  g_free (basename);
-                }
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_EDIT_NAME))
-                {
-                  gchar* pathname = (gchar*) archive_entry_pathname_utf8 (ent);
-                  gchar* basename = (gchar*) g_path_get_basename (pathname);
+      if (entry != NULL && entry->size >= 0)
+        {
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_SIZE))
+            g_file_info_set_size (info, entry->size);
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE))
+            g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE, entry->size);
+        }
 
-                  g_file_info_set_edit_name (info, basename);
-                  g_free (basename);
-                }
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_COPY_NAME))
-                {
-                  gchar* pathname = (gchar*) archive_entry_pathname_utf8 (ent);
-                  gchar* basename = (gchar*) g_path_get_basename (pathname);
+      if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_ACCESS_CAN_READ))
+        g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ, TRUE);
+      if (entry != NULL && g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_UNIX_MODE))
+        g_file_info_set_attribute_uint32 (info, G_FILE_ATTRIBUTE_UNIX_MODE, entry->mode);
 
-                  g_file_info_set_attribute_string (info, G_FILE_ATTRIBUTE_STANDARD_COPY_NAME, basename);
-                  g_free (basename);
-                }
+      if (entry != NULL && (entry->flags & LP_PACK_INDEX_HAS_ATIME))
+        {
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_ACCESS))
+            g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_ACCESS, times->atime.sec);
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_ACCESS_NSEC))
+            g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_ACCESS_NSEC, times->atime.nsec);
+        }
 
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_SIZE))
-                g_file_info_set_size (info, (goffset) archive_entry_size (ent));
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE))
-                g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_STANDARD_ALLOCATED_SIZE, archive_entry_size (ent));
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_STANDARD_SYMLINK_TARGET))
-                g_file_info_set_symlink_target (info, archive_entry_symlink (ent));
-              if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_ACCESS_CAN_READ))
-                g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ, TRUE);
+      if (entry != NULL && (entry->flags & LP_PACK_INDEX_HAS_BIRTHTIME))
+        {
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CREATED))
+            g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CREATED, times->btime.sec);
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CREATED_NSEC))
+            g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CREATED_NSEC, times->btime.nsec);
+        }
 
-              if (archive_entry_atime_is_set (ent))
-                {
-                  if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_ACCESS))
-                    g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_ACCESS, archive_entry_atime (ent));
-                  if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_ACCESS_NSEC))
-                    g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_ACCESS_NSEC, archive_entry_atime_nsec (ent));
-                }
+      if (entry != NULL && (entry->flags & LP_PACK_INDEX_HAS_CTIME))
+        {
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CHANGED))
+            g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED, times->ctime.sec);
+          if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CHANGED_NSEC))
+            g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED_NSEC, times->ctime.nsec);
+        }
 
-              if (archive_entry_birthtime_is_set (ent))
-                {
-                  if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CREATED))
-                    g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CREATED, archive_entry_birthtime (ent));
-                  if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CREATED_NSEC))
-                    g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CREATED_NSEC, archive_entry_birthtime_nsec (ent));
-                }
+      g_file_attribute_matcher_unref (matcher);
+      g_free (basename);
+    }
+return (key_clear (&key), info);
+}
 
-              if (archive_entry_ctime_is_set (ent))
-                {
-                  if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CHANGED))
-                    g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED, archive_entry_ctime (ent));
-                  if (g_file_attribute_matcher_matches (matcher, G_FILE_ATTRIBUTE_TIME_CHANGED_NSEC))
-                    g_file_info_set_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_CHANGED_NSEC, archive_entry_ctime_nsec (ent));
-                }
+/**
+ * lp_pack_reader_query_info_async:
+ * @reader: #LpPackReader instance.
+ * @path: path to look up in @reader.
+ * @attributes: an attribute query string.
+ * @io_priority: the I/O priority of the request.
+ * @cancellable: (nullable): optional #GCancellable object, %NULL to ignore.
+ * @callback: (scope async): a #GAsyncReadyCallback to call when the request is satisfied.
+ * @user_data: (closure): the data to pass to callback function.
+ *
+ * Asynchronously queries info about @path. See
+ * #lp_pack_reader_query_info for the synchronous version of
+ * this call.
+*/
+void lp_pack_reader_query_info_async (LpPackReader* reader, const gchar* path, const gchar* attributes, int io_priority, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer user_data)
+{
+  g_return_if_fail (LP_IS_PACK_READER (reader));
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (attributes != NULL);
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  GTask* task = g_task_new (reader, cancellable, callback, user_data);
+  GError* tmperr = NULL;
+  GFileInfo* info = NULL;
 
-              g_file_attribute_matcher_unref (matcher);
+  g_task_set_priority (task, io_priority);
+  g_task_set_source_tag (task, lp_pack_reader_query_info_async);
 
-              if ((result = closepack (ar, source, &reader, error)), G_UNLIKELY (result != ARCHIVE_OK))
-                g_clear_object (&info);
-            }
-        }
-    }
-return info;
+  /*
+   * Metadata is kept in memory since the pack was scanned, so
+   * there is nothing worth a worker thread here
+   */
+  if ((info = lp_pack_reader_query_info (reader, path, attributes, &tmperr)), G_LIKELY (info != NULL))
+    g_task_return_pointer (task, info, g_object_unref);
+  else
+    g_task_return_error (task, tmperr);
+  g_object_unref (task);
+}
+
+/**
+ * lp_pack_reader_query_info_finish:
+ * @reader: #LpPackReader instance.
+ * @result: a #GAsyncResult.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Finishes an operation started with #lp_pack_reader_query_info_async.
+ *
+ * Returns: (transfer full): a #GFileInfo for @path.
+*/
+GFileInfo* lp_pack_reader_query_info_finish (LpPackReader* reader, GAsyncResult* result, GError** error)
+{
+  g_return_val_if_fail (LP_IS_PACK_READER (reader), NULL);
+  g_return_val_if_fail (g_task_is_valid (result, reader), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+return g_task_propagate_pointer (G_TASK (result), error);
 }
@@ -30,6 +30,25 @@ typedef enum
   LP_PACK_READER_ERROR_SCAN,
 } LpPackReaderError;
 
+/**
+ * LpPackReaderFilterFunc:
+ * @path: packed file path.
+ * @user_data: data passed to the function taking this callback.
+ *
+ * Returns: whether @path should be visited.
+*/
+typedef gboolean (*LpPackReaderFilterFunc) (const gchar* path, gpointer user_data);
+
+/**
+ * LpPackReaderForeachFunc:
+ * @path: packed file path.
+ * @contents: contents of @path.
+ * @user_data: data passed to the function taking this callback.
+ *
+ * Returns: %FALSE to stop visiting further paths.
+*/
+typedef gboolean (*LpPackReaderForeachFunc) (const gchar* path, GBytes* contents, gpointer user_data);
+
 #if __cplusplus
 extern "C" {
 #endif // __cplusplus
@@ -40,12 +59,24 @@ extern "C" {
 
   gboolean lp_pack_reader_add_from_bytes (LpPackReader* reader, GBytes* bytes, GError** error);
   gboolean lp_pack_reader_add_from_file (LpPackReader* reader, GFile* file, GError** error);
+  void lp_pack_reader_add_from_file_async (LpPackReader* reader, GFile* file, int io_priority, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer user_data);
+  gboolean lp_pack_reader_add_from_file_finish (LpPackReader* reader, GAsyncResult* result, GError** error);
+  gboolean lp_pack_reader_add_from_files (LpPackReader* reader, GFile** files, guint n_files, GError** error);
   gboolean lp_pack_reader_add_from_filename (LpPackReader* reader, const gchar* filename, GError** error);
   gboolean lp_pack_reader_add_from_stream (LpPackReader* reader, GInputStream* stream, GError** error);
   gboolean lp_pack_reader_contains (LpPackReader* reader, const gchar* path);
+  gchar** lp_pack_reader_enumerate_children (LpPackReader* reader, const gchar* path, GError** error);
+  gchar** lp_pack_reader_enumerate_prefix (LpPackReader* reader, const gchar* path, GError** error);
+  gboolean lp_pack_reader_extract_many (LpPackReader* reader, const gchar* const* paths, LpPackReaderForeachFunc func, gpointer user_data, GError** error);
+  gboolean lp_pack_reader_foreach (LpPackReader* reader, LpPackReaderFilterFunc filter, LpPackReaderForeachFunc func, gpointer user_data, GError** error);
+  GBytes* lp_pack_reader_lookup_bytes (LpPackReader* reader, const gchar* path, GError** error);
   LpPackReader* lp_pack_reader_new ();
   GInputStream* lp_pack_reader_open (LpPackReader* reader, const gchar* path, GError** error);
+  void lp_pack_reader_open_async (LpPackReader* reader, const gchar* path, int io_priority, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer user_data);
+  GInputStream* lp_pack_reader_open_finish (LpPackReader* reader, GAsyncResult* result, GError** error);
   GFileInfo* lp_pack_reader_query_info (LpPackReader* reader, const gchar* path, const gchar* attributes, GError** error);
+  void lp_pack_reader_query_info_async (LpPackReader* reader, const gchar* path, const gchar* attributes, int io_priority, GCancellable* cancellable, GAsyncReadyCallback callback, gpointer user_data);
+  GFileInfo* lp_pack_reader_query_info_finish (LpPackReader* reader, GAsyncResult* result, GError** error);
 
 #if __cplusplus
 }
@@ -0,0 +1,528 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <bufferpool.h>
+#include <lzma.h>
+#include <stdlib.h>
+#include <xzindex.h>
+
+struct _LpXzIndex
+{
+  lzma_index* index;
+  lzma_stream_flags flags;
+};
+
+struct _LpXzReader
+{
+  GInputStream* stream;
+  GMutex* lock;
+  LpXzIndex* index;
+
+  lzma_block block;
+  lzma_filter filters [LZMA_FILTERS_MAX + 1];
+  lzma_index_iter iter;
+  lzma_stream xz;
+
+  guint active : 1;
+  guint64 left;
+  goffset position;
+  guint8* buffer;
+  gsize buffer_size;
+};
+
+#define xzerror(error, funcname, ret) \
+  G_STMT_START { \
+    GError** __error = (error); \
+    lzma_ret __ret = (ret); \
+ ; \
+    g_set_error (__error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, #funcname "()!: %s", xzstrerror (__ret)); \
+  } G_STMT_END
+
+static const gchar* xzstrerror (lzma_ret ret)
+{
+  switch (ret)
+    {
+      default: return "unknown error";
+      case LZMA_MEM_ERROR: return "cannot allocate memory";
+      case LZMA_MEMLIMIT_ERROR: return "memory usage limit reached";
+      case LZMA_FORMAT_ERROR: return "file format not recognized";
+      case LZMA_OPTIONS_ERROR: return "unsupported options";
+      case LZMA_DATA_ERROR: return "compressed data is corrupt";
+      case LZMA_BUF_ERROR: return "unexpected end of input";
+      case LZMA_PROG_ERROR: return "programming error";
+    }
+}
+
+static gboolean readat (GInputStream* stream, goffset offset, gpointer buffer, gsize size, GError** error)
+{
+  gsize read = 0;
+
+  if (G_UNLIKELY (g_seekable_seek (G_SEEKABLE (stream), offset, G_SEEK_SET, NULL, error) == FALSE))
+    return FALSE;
+  else if (G_UNLIKELY (g_input_stream_read_all (stream, buffer, size, &read, NULL, error) == FALSE))
+    return FALSE;
+  else if (G_UNLIKELY (read < size))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "truncated xz stream");
+      return FALSE;
+    }
+return TRUE;
+}
+
+static gboolean lockedreadat (LpXzReader* self, goffset offset, gpointer buffer, gsize size, GError** error)
+{
+  gboolean good;
+
+  if (self->lock != NULL)
+    g_mutex_lock (self->lock);
+
+  good = readat (self->stream, offset, buffer, size, error);
+
+  if (self->lock != NULL)
+    g_mutex_unlock (self->lock);
+return good;
+}
+
+static gssize lockedread (LpXzReader* self, gpointer buffer, gsize size, GError** error)
+{
+  gssize read = -1;
+
+  /*
+   * A shared stream may have been moved by someone else since
+   * the last read, so seek back to where this reader left it
+   */
+  if (self->lock == NULL)
+    read = g_input_stream_read (self->stream, buffer, size, NULL, error);
+  else
+    {
+      g_mutex_lock (self->lock);
+
+      if (g_seekable_seek (G_SEEKABLE (self->stream), self->position, G_SEEK_SET, NULL, error))
+        read = g_input_stream_read (self->stream, buffer, size, NULL, error);
+
+      g_mutex_unlock (self->lock);
+    }
+
+  if (G_LIKELY (read > 0))
+    self->position += read;
+return read;
+}
+
+/**
+ * lp_xz_index_load:
+ * @stream: seekable stream holding a xz stream.
+ * @length: length of the xz stream within @stream.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Decodes the block index stored before the footer of the xz stream
+ * found at the beginning of @stream. Only single, unpadded streams
+ * are supported, which is what the pack builder produces.
+ *
+ * Returns: (transfer full): a new #LpXzIndex instance.
+*/
+LpXzIndex* lp_xz_index_load (GInputStream* stream, goffset length, GError** error)
+{
+  guint8 footer [LZMA_STREAM_HEADER_SIZE];
+  lzma_stream_flags flags = {0};
+  lzma_index* index = NULL;
+  uint64_t memlimit = UINT64_MAX;
+  guint8* data = NULL;
+  size_t position = 0;
+  lzma_ret ret;
+
+  if (G_UNLIKELY (length < 2 * LZMA_STREAM_HEADER_SIZE))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "truncated xz stream");
+      return NULL;
+    }
+
+  if (readat (stream, length - LZMA_STREAM_HEADER_SIZE, footer, sizeof (footer), error) == FALSE)
+    return NULL;
+  else if ((ret = lzma_stream_footer_decode (&flags, footer)), G_UNLIKELY (ret != LZMA_OK))
+    {
+      xzerror (error, lzma_stream_footer_decode, ret);
+      return NULL;
+    }
+  else if (G_UNLIKELY (flags.backward_size > (guint64) length - 2 * LZMA_STREAM_HEADER_SIZE))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "truncated xz stream");
+      return NULL;
+    }
+
+  data = g_malloc (flags.backward_size);
+
+  if (readat (stream, length - LZMA_STREAM_HEADER_SIZE - flags.backward_size, data, flags.backward_size, error) == FALSE)
+    {
+      g_free (data);
+      return NULL;
+    }
+  else if ((ret = lzma_index_buffer_decode (&index, &memlimit, NULL, data, &position, flags.backward_size), g_free (data)), G_UNLIKELY (ret != LZMA_OK))
+    {
+      xzerror (error, lzma_index_buffer_decode, ret);
+      return NULL;
+    }
+  else if (G_UNLIKELY (lzma_index_stream_size (index) != (guint64) length))
+    {
+      /* concatenated streams or stream padding */
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED, "unsupported xz stream layout");
+      lzma_index_end (index, NULL);
+      return NULL;
+    }
+  else
+    {
+      LpXzIndex template = { .index = index, .flags = flags, };
+      return g_slice_dup (LpXzIndex, &template);
+    }
+}
+
+/**
+ * lp_xz_index_get_blocks:
+ * @index: #LpXzIndex instance.
+ *
+ * Returns: number of blocks in @index.
+*/
+guint64 lp_xz_index_get_blocks (LpXzIndex* index)
+{
+  return lzma_index_block_count (index->index);
+}
+
+/**
+ * lp_xz_index_free:
+ * @index: #LpXzIndex instance.
+ *
+ * Releases @index.
+*/
+void lp_xz_index_free (LpXzIndex* index)
+{
+  lzma_index_end (index->index, NULL);
+  g_slice_free (LpXzIndex, index);
+}
+
+static void freefilters (LpXzReader* self)
+{
+  guint i;
+
+  for (i = 0; self->filters [i].id != LZMA_VLI_UNKNOWN; ++i)
+    {
+      free (self->filters [i].options);
+      self->filters [i].options = NULL;
+    }
+
+  self->filters [0].id = LZMA_VLI_UNKNOWN;
+}
+
+static gboolean beginblock (LpXzReader* self, GError** error)
+{
+  const goffset offset = (goffset) self->iter.block.compressed_file_offset;
+  const guint64 total = self->iter.block.total_size;
+  guint8 header [LZMA_BLOCK_HEADER_SIZE_MAX];
+  lzma_ret ret;
+
+  freefilters (self);
+
+  if (lockedreadat (self, offset, header, 1, error) == FALSE)
+    return FALSE;
+
+  self->block = (lzma_block) {0};
+  self->block.version = 1;
+  self->block.check = self->index->flags.check;
+  self->block.filters = self->filters;
+  self->block.header_size = lzma_block_header_size_decode (header [0]);
+
+  if (G_UNLIKELY (header [0] == 0 || self->block.header_size > total))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "malformed xz block");
+      return FALSE;
+    }
+  else if (lockedreadat (self, offset + 1, header + 1, self->block.header_size - 1, error) == FALSE)
+    return FALSE;
+  else if ((ret = lzma_block_header_decode (&self->block, NULL, header)), G_UNLIKELY (ret != LZMA_OK))
+    {
+      xzerror (error, lzma_block_header_decode, ret);
+      return FALSE;
+    }
+  else if ((ret = lzma_block_compressed_size (&self->block, self->iter.block.unpadded_size)), G_UNLIKELY (ret != LZMA_OK))
+    {
+      xzerror (error, lzma_block_compressed_size, ret);
+      return FALSE;
+    }
+  else if ((ret = lzma_block_decoder (&self->xz, &self->block)), G_UNLIKELY (ret != LZMA_OK))
+    {
+      xzerror (error, lzma_block_decoder, ret);
+      return FALSE;
+    }
+
+  self->active = TRUE;
+  self->left = total - self->block.header_size;
+  self->position = offset + self->block.header_size;
+  self->xz.avail_in = 0;
+return TRUE;
+}
+
+/**
+ * lp_xz_reader_new:
+ * @index: #LpXzIndex describing the xz stream in @stream.
+ * @stream: seekable stream holding a xz stream.
+ * @lock: (nullable): mutex guarding @stream, if it is shared.
+ * @offset: uncompressed offset where to start reading.
+ * @buffer_size: size of the buffers (taken from the buffer pool)
+ * used to read compressed data and to discard decoded one.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Creates a reader which decompress the xz stream in @stream
+ * starting from uncompressed offset @offset. Decoding starts at the
+ * block containing @offset, so only the head of that block needs
+ * to be decoded and discarded. If @lock is given, every access to
+ * @stream seeks to the reader own position while holding it, so
+ * any number of readers can share @stream.
+ * @index must outlive the returned reader.
+ *
+ * Returns: (transfer full): a new #LpXzReader instance.
+*/
+LpXzReader* lp_xz_reader_new (LpXzIndex* index, GInputStream* stream, GMutex* lock, guint64 offset, gsize buffer_size, GError** error)
+{
+  LpXzReader* self = g_slice_new0 (LpXzReader);
+  guint8* scratch = NULL;
+  guint64 skip;
+  gssize read;
+
+  /* a zeroed lzma_stream is equivalent to LZMA_STREAM_INIT */
+  self->stream = g_object_ref (stream);
+  self->lock = lock;
+  self->index = index;
+  self->filters [0].id = LZMA_VLI_UNKNOWN;
+  self->buffer = lp_buffer_pool_acquire (self->buffer_size = buffer_size);
+
+  lzma_index_iter_init (&self->iter, index->index);
+
+  if (G_UNLIKELY (lzma_index_iter_locate (&self->iter, offset)))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "offset out of xz stream bounds");
+      return (lp_xz_reader_free (self), NULL);
+    }
+  else if (G_UNLIKELY (beginblock (self, error) == FALSE))
+    return (lp_xz_reader_free (self), NULL);
+
+  if ((skip = offset - self->iter.block.uncompressed_file_offset) > 0)
+    scratch = lp_buffer_pool_acquire (buffer_size);
+
+  for (; skip > 0; skip -= read)
+    {
+      if ((read = lp_xz_reader_read (self, scratch, (gsize) MIN (skip, buffer_size), error)), G_UNLIKELY (read <= 0))
+        {
+          if (read == 0)
+            g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "truncated xz stream");
+          lp_buffer_pool_release (scratch, buffer_size);
+          return (lp_xz_reader_free (self), NULL);
+        }
+    }
+
+  lp_buffer_pool_release (scratch, buffer_size);
+return self;
+}
+
+/**
+ * lp_xz_reader_read:
+ * @reader: #LpXzReader instance.
+ * @buffer: where to store decompressed data.
+ * @count: size of @buffer.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Decompress up to @count bytes into @buffer, moving across
+ * block boundaries as needed.
+ *
+ * Returns: number of bytes stored into @buffer, zero on
+ * end of stream, or -1 on error.
+*/
+gssize lp_xz_reader_read (LpXzReader* reader, gpointer buffer, gsize count, GError** error)
+{
+  LpXzReader* self = (reader);
+  lzma_ret ret;
+
+  self->xz.next_out = buffer;
+  self->xz.avail_out = count;
+
+  while (count > 0 && self->xz.avail_out == count)
+    {
+      if (self->active == FALSE)
+        {
+          if (lzma_index_iter_next (&self->iter, LZMA_INDEX_ITER_BLOCK))
+            break;
+          else if (G_UNLIKELY (beginblock (self, error) == FALSE))
+            return -1;
+        }
+
+      if (self->xz.avail_in == 0 && self->left > 0)
+        {
+          gsize want = (gsize) MIN (self->left, self->buffer_size);
+          gssize read;
+
+          if ((read = lockedread (self, self->buffer, want, error)), G_UNLIKELY (read < 0))
+            return -1;
+          else if (G_UNLIKELY (read == 0))
+            {
+              g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA, "truncated xz stream");
+              return -1;
+            }
+
+          self->left -= read;
+          self->xz.next_in = self->buffer;
+          self->xz.avail_in = read;
+        }
+
+      if ((ret = lzma_code (&self->xz, LZMA_RUN)), ret == LZMA_STREAM_END)
+        self->active = FALSE;
+      else if (G_UNLIKELY (ret != LZMA_OK))
+        {
+          xzerror (error, lzma_code, ret);
+          return -1;
+        }
+    }
+return (gssize) (count - self->xz.avail_out);
+}
+
+/**
+ * lp_xz_reader_free:
+ * @reader: #LpXzReader instance.
+ *
+ * Releases @reader.
+*/
+void lp_xz_reader_free (LpXzReader* reader)
+{
+  lzma_end (&reader->xz);
+  freefilters (reader);
+  lp_buffer_pool_release (reader->buffer, reader->buffer_size);
+  g_object_unref (reader->stream);
+  g_slice_free (LpXzReader, reader);
+}
+
+static gboolean encodeall (lzma_stream* xz, lzma_action action, GOutputStream* output, guint8* buffer, gsize size, GCancellable* cancellable, GError** error)
+{
+  lzma_ret ret;
+
+  do
+    {
+      xz->next_out = buffer;
+      xz->avail_out = size;
+
+      if ((ret = lzma_code (xz, action)), G_UNLIKELY (ret != LZMA_OK && ret != LZMA_STREAM_END))
+        {
+          xzerror (error, lzma_code, ret);
+          return FALSE;
+        }
+      else if (g_output_stream_write_all (output, buffer, size - xz->avail_out, NULL, cancellable, error) == FALSE)
+        return FALSE;
+    }
+  while (xz->avail_in > 0 || (action != LZMA_RUN && ret != LZMA_STREAM_END));
+return TRUE;
+}
+
+/**
+ * lp_xz_recode:
+ * @input: stream holding a xz stream.
+ * @output: stream where to write the recoded xz stream.
+ * @preset: xz preset (see lzma_easy_encoder) to encode with.
+ * @block_size: uncompressed size of each block.
+ * @buffer_size: size of the buffers (taken from the buffer pool)
+ * data is moved around with.
+ * @cancellable: (nullable): a #GCancellable object.
+ * @error: return location for a #GError, or %NULL.
+ *
+ * Decompress the xz stream at the beginning of @input and writes it
+ * back into @output, this time split in blocks of @block_size
+ * uncompressed bytes each, so it can be decoded starting at any of
+ * them (see lp_xz_reader_new).
+ *
+ * Returns: if operation was successful.
+*/
+gboolean lp_xz_recode (GInputStream* input, GOutputStream* output, guint32 preset, guint64 block_size, gsize buffer_size, GCancellable* cancellable, GError** error)
+{
+  lzma_stream decoder = LZMA_STREAM_INIT;
+  lzma_stream encoder = LZMA_STREAM_INIT;
+  guint8* inbuf = lp_buffer_pool_acquire (buffer_size);
+  guint8* midbuf = lp_buffer_pool_acquire (buffer_size);
+  guint8* outbuf = lp_buffer_pool_acquire (buffer_size);
+  gboolean eof = FALSE, good = TRUE;
+  guint64 block = 0;
+  lzma_ret ret;
+
+  if ((ret = lzma_stream_decoder (&decoder, UINT64_MAX, 0)), G_UNLIKELY (ret != LZMA_OK))
+    {
+      xzerror (error, lzma_stream_decoder, ret);
+      good = FALSE;
+    }
+  else if ((ret = lzma_easy_encoder (&encoder, preset, LZMA_CHECK_CRC64)), G_UNLIKELY (ret != LZMA_OK))
+    {
+      xzerror (error, lzma_easy_encoder, ret);
+      good = FALSE;
+    }
+
+  while (good && ret != LZMA_STREAM_END)
+    {
+      /* decoded chunks never cross a block boundary */
+      const gsize want = (gsize) MIN ((guint64) buffer_size, block_size - block);
+      gssize read;
+
+      /* not every stream checks @cancellable by itself */
+      if (g_cancellable_set_error_if_cancelled (cancellable, error))
+        {
+          good = FALSE;
+          break;
+        }
+      else if (decoder.avail_in == 0 && eof == FALSE)
+        {
+          if ((read = g_input_stream_read (input, inbuf, buffer_size, cancellable, error)), G_UNLIKELY (read < 0))
+            {
+              good = FALSE;
+              break;
+            }
+
+          eof = read == 0;
+          decoder.next_in = inbuf;
+          decoder.avail_in = (gsize) read;
+        }
+
+      decoder.next_out = midbuf;
+      decoder.avail_out = want;
+
+      if ((ret = lzma_code (&decoder, eof ? LZMA_FINISH : LZMA_RUN)), G_UNLIKELY (ret != LZMA_OK && ret != LZMA_STREAM_END))
+        {
+          xzerror (error, lzma_code, ret);
+          good = FALSE;
+          break;
+        }
+
+      encoder.next_in = midbuf;
+      encoder.avail_in = want - decoder.avail_out;
+      block += encoder.avail_in;
+
+      if (encoder.avail_in > 0 && G_UNLIKELY (encodeall (&encoder, LZMA_RUN, output, outbuf, buffer_size, cancellable, error) == FALSE))
+        good = FALSE;
+      else if (block == block_size && (block = 0, encodeall (&encoder, LZMA_FULL_FLUSH, output, outbuf, buffer_size, cancellable, error)) == FALSE)
+        good = FALSE;
+    }
+
+  if (G_LIKELY (good == TRUE))
+    good = encodeall (&encoder, LZMA_FINISH, output, outbuf, buffer_size, cancellable, error);
+
+  lzma_end (&decoder);
+  lzma_end (&encoder);
+  lp_buffer_pool_release (inbuf, buffer_size);
+  lp_buffer_pool_release (midbuf, buffer_size);
+  lp_buffer_pool_release (outbuf, buffer_size);
+return good;
+}
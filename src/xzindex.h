@@ -0,0 +1,40 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __LP_XZ_INDEX__
+#define __LP_XZ_INDEX__ 1
+#include <gio/gio.h>
+
+typedef struct _LpXzIndex LpXzIndex;
+typedef struct _LpXzReader LpXzReader;
+
+#if __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+  LpXzIndex* lp_xz_index_load (GInputStream* stream, goffset length, GError** error);
+  guint64 lp_xz_index_get_blocks (LpXzIndex* index);
+  void lp_xz_index_free (LpXzIndex* index);
+  LpXzReader* lp_xz_reader_new (LpXzIndex* index, GInputStream* stream, GMutex* lock, guint64 offset, gsize buffer_size, GError** error);
+  gssize lp_xz_reader_read (LpXzReader* reader, gpointer buffer, gsize count, GError** error);
+  void lp_xz_reader_free (LpXzReader* reader);
+  gboolean lp_xz_recode (GInputStream* input, GOutputStream* output, guint32 preset, guint64 block_size, gsize buffer_size, GCancellable* cancellable, GError** error);
+
+#if __cplusplus
+}
+#endif // __cplusplus
+
+#endif // __LP_XZ_INDEX__
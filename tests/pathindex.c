@@ -0,0 +1,272 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <pathindex.h>
+#include <string.h>
+
+#define n_paths (5000)
+
+static void checknormal (const gchar* path, const gchar* expected)
+{
+  const gchar* got = NULL;
+  gchar buffer [64];
+  guint32 hash;
+  gsize length;
+
+  got = lp_path_normalize (path, buffer, sizeof (buffer), &length, &hash);
+  g_assert_nonnull (got);
+  g_assert_cmpstr (got, ==, expected);
+  g_assert_cmpuint (length, ==, strlen (expected));
+  g_assert_cmpuint (hash, ==, lp_path_hash (expected, length));
+}
+
+static void test_normalize (void)
+{
+  const gchar* path = "dir/sub/file.txt";
+  gchar buffer [64];
+  guint32 hash;
+  gsize length;
+
+  checknormal ("", "");
+  checknormal ("/", "");
+  checknormal ("a", "a");
+  checknormal ("a/b", "a/b");
+  checknormal ("/a/b", "a/b");
+  checknormal ("a/b/", "a/b");
+  checknormal ("//a//b//", "a/b");
+  checknormal ("./a/./b/.", "a/b");
+  checknormal ("a/../b", "b");
+  checknormal ("a/b/../../c", "c");
+  checknormal ("a/b/..", "a");
+  checknormal ("/../../a/..", "");
+  checknormal ("..", "");
+  checknormal ("a/..b/c..", "a/..b/c..");
+  checknormal (".hidden/.x/...", ".hidden/.x/...");
+
+  /* paths in normal form are returned as they are */
+  g_assert_true (lp_path_normalize (path, buffer, sizeof (buffer), &length, &hash) == path);
+}
+
+static void test_normalize_long (void)
+{
+  GString* path = g_string_new (NULL);
+  gchar buffer [8];
+  guint32 hash;
+  gsize length;
+  guint i;
+
+  /* the normal form and its terminator must fit */
+  g_assert_nonnull (lp_path_normalize ("/abcdefg", buffer, sizeof (buffer), &length, &hash));
+  g_assert_cmpuint (length, ==, 7);
+  g_assert_null (lp_path_normalize ("/abcdefgh", buffer, sizeof (buffer), &length, &hash));
+  g_assert_null (lp_path_normalize ("a/b/c/d/e/f/", buffer, sizeof (buffer), &length, &hash));
+
+  /* ... unless already in normal form, which needs no buffer */
+  g_assert_nonnull (lp_path_normalize ("abcdefghijklmnop", buffer, sizeof (buffer), &length, &hash));
+  g_assert_cmpuint (length, ==, 16);
+
+  /* only what is left matters, not how long the path was */
+  for (i = 0; i < 1000; ++i)
+    g_string_append (path, "tmp/../");
+
+  g_string_append (path, "a");
+  g_assert_cmpstr (lp_path_normalize (path->str, buffer, sizeof (buffer), &length, &hash), ==, "a");
+  g_string_free (path, TRUE);
+}
+
+static void countpath (const gchar* path, gpointer value, gpointer user_data)
+{
+  *(guint64*) user_data += GPOINTER_TO_UINT (value);
+}
+
+static gpointer lookup (LpPathIndex* index, const gchar* path, const gchar** key)
+{
+  return lp_path_index_lookup (index, path, strlen (path), lp_path_hash (path, strlen (path)), key);
+}
+
+static gboolean insert (LpPathIndex* index, const gchar* path, guint value)
+{
+  return lp_path_index_insert (index, path, strlen (path), lp_path_hash (path, strlen (path)), GUINT_TO_POINTER (value));
+}
+
+static void test_index (void)
+{
+  GPtrArray* paths = g_ptr_array_new_with_free_func (g_free);
+  LpPathIndex* index = lp_path_index_new ();
+  const gchar* key = NULL;
+  gchar* path = NULL;
+  guint64 sum = 0;
+  guint i;
+
+  g_assert_null (lookup (index, "missing", NULL));
+
+  for (i = 0; i < n_paths; ++i)
+    g_ptr_array_add (paths, g_strdup_printf ("dir%u/file%u", i % 7, i));
+  for (i = 0; i < n_paths; ++i)
+    g_assert_true (insert (index, paths->pdata [i], i + 1));
+
+  /* paths are not copied, equal ones are not inserted twice */
+  path = g_strdup (paths->pdata [0]);
+  g_assert_false (insert (index, path, 0));
+  g_assert_cmpuint (lp_path_index_get_size (index), ==, n_paths);
+
+  for (i = 0; i < n_paths; ++i)
+    {
+      g_assert_cmpuint (GPOINTER_TO_UINT (lookup (index, paths->pdata [i], &key)), ==, i + 1);
+      g_assert_true (key == paths->pdata [i]);
+    }
+
+  g_assert_cmpuint (GPOINTER_TO_UINT (lookup (index, path, &key)), ==, 1);
+  g_assert_true (key == paths->pdata [0]);
+  g_assert_null (lookup (index, "dir0/missing", NULL));
+  g_assert_null (lookup (index, "dir0", NULL));
+  g_assert_null (lp_path_index_lookup (index, paths->pdata [0], 4, lp_path_hash (paths->pdata [0], 4), NULL));
+
+  lp_path_index_foreach (index, countpath, &sum);
+  g_assert_cmpuint (sum, ==, (guint64) n_paths * (n_paths + 1) / 2);
+
+  lp_path_index_remove_all (index);
+  g_assert_cmpuint (lp_path_index_get_size (index), ==, 0);
+  g_assert_null (lookup (index, paths->pdata [0], NULL));
+  g_assert_true (insert (index, paths->pdata [0], 1));
+
+  lp_path_index_free (index);
+  g_ptr_array_unref (paths);
+  g_free (path);
+}
+
+static void checkpresent (LpPathIndex* index, GPtrArray* paths, guint count)
+{
+  guint i;
+
+  for (i = 0; i < count; ++i)
+    g_assert_cmpuint (GPOINTER_TO_UINT (lookup (index, paths->pdata [i], NULL)), ==, i + 1);
+}
+
+static void test_bloom (void)
+{
+  GPtrArray* paths = g_ptr_array_new_with_free_func (g_free);
+  GPtrArray* misses = g_ptr_array_new_with_free_func (g_free);
+  const gchar* same [] = { "same/a", "same/b", "same/c", "same/d", };
+  LpPathIndex* index = lp_path_index_new ();
+  LpPathIndex* other = lp_path_index_new ();
+  const gchar* path = NULL;
+  guint i;
+
+  for (i = 0; i < n_paths; ++i)
+    {
+      g_ptr_array_add (paths, g_strdup_printf ("share/app%u/data%u.bin", i % 13, i));
+      g_ptr_array_add (misses, g_strdup_printf ("share/app%u/data%u.txt", i % 13, i));
+    }
+
+  /* every growth rebuilds the filter, nothing inserted before may get lost */
+  for (i = 0; i < n_paths; ++i)
+    {
+      g_assert_true (insert (index, paths->pdata [i], i + 1));
+
+      if ((i & (i + 1)) == 0 || i % 331 == 0)
+        checkpresent (index, paths, i + 1);
+    }
+
+  checkpresent (index, paths, n_paths);
+
+  for (i = 0; i < n_paths; ++i)
+    {
+      path = misses->pdata [i];
+      g_assert_null (lookup (index, path, NULL));
+
+      /* a filter hit must still be checked against the slots */
+      g_assert_null (lp_path_index_lookup (index, path, strlen (path), lp_path_hash (paths->pdata [i], strlen (paths->pdata [i])), NULL));
+    }
+
+  /* paths sharing a hash share filter bits too */
+  for (i = 0; i < G_N_ELEMENTS (same); ++i)
+    g_assert_true (lp_path_index_insert (other, same [i], strlen (same [i]), 0, GUINT_TO_POINTER (i + 1)));
+  for (i = 0; i < G_N_ELEMENTS (same); ++i)
+    g_assert_cmpuint (GPOINTER_TO_UINT (lp_path_index_lookup (other, same [i], strlen (same [i]), 0, NULL)), ==, i + 1);
+
+  g_assert_null (lp_path_index_lookup (other, "same/e", 6, 0, NULL));
+
+  /* merged paths set their bits in the filter of the index they land in */
+  g_assert_null (lp_path_index_merge (other, index, NULL, NULL));
+  g_assert_cmpuint (lp_path_index_get_size (index), ==, 0);
+  g_assert_null (lookup (index, paths->pdata [0], NULL));
+  checkpresent (other, paths, n_paths);
+
+  for (i = 0; i < G_N_ELEMENTS (same); ++i)
+    g_assert_cmpuint (GPOINTER_TO_UINT (lp_path_index_lookup (other, same [i], strlen (same [i]), 0, NULL)), ==, i + 1);
+  for (i = 0; i < n_paths; ++i)
+    g_assert_null (lookup (other, misses->pdata [i], NULL));
+
+  lp_path_index_free (other);
+  lp_path_index_free (index);
+  g_ptr_array_unref (misses);
+  g_ptr_array_unref (paths);
+}
+
+static gboolean prefer (const gchar* path, gpointer current, gpointer value, gpointer user_data)
+{
+  ++*(guint*) user_data;
+return GPOINTER_TO_UINT (value) > GPOINTER_TO_UINT (current);
+}
+
+static void test_merge (void)
+{
+  LpPathIndex* index = lp_path_index_new ();
+  LpPathIndex* other = lp_path_index_new ();
+  guint calls = 0;
+
+  insert (index, "x", 1);
+  insert (index, "y", 2);
+  insert (other, "y", 3);
+  insert (other, "z", 4);
+
+  /* nothing moves if any path clashes and there is no resolver */
+  g_assert_cmpstr (lp_path_index_merge (index, other, NULL, NULL), ==, "y");
+  g_assert_cmpuint (lp_path_index_get_size (index), ==, 2);
+  g_assert_cmpuint (lp_path_index_get_size (other), ==, 2);
+  g_assert_null (lookup (index, "z", NULL));
+
+  g_assert_null (lp_path_index_merge (index, other, prefer, &calls));
+  g_assert_cmpuint (calls, ==, 1);
+  g_assert_cmpuint (lp_path_index_get_size (index), ==, 3);
+  g_assert_cmpuint (lp_path_index_get_size (other), ==, 0);
+  g_assert_cmpuint (GPOINTER_TO_UINT (lookup (index, "x", NULL)), ==, 1);
+  g_assert_cmpuint (GPOINTER_TO_UINT (lookup (index, "y", NULL)), ==, 3);
+  g_assert_cmpuint (GPOINTER_TO_UINT (lookup (index, "z", NULL)), ==, 4);
+
+  /* a resolver may keep what is there */
+  insert (other, "x", 0);
+  g_assert_null (lp_path_index_merge (index, other, prefer, &calls));
+  g_assert_cmpuint (calls, ==, 2);
+  g_assert_cmpuint (GPOINTER_TO_UINT (lookup (index, "x", NULL)), ==, 1);
+
+  lp_path_index_free (other);
+  lp_path_index_free (index);
+}
+
+int main (int argc, char* argv [])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/pathindex/normalize", test_normalize);
+  g_test_add_func ("/pathindex/normalize/long", test_normalize_long);
+  g_test_add_func ("/pathindex/index", test_index);
+  g_test_add_func ("/pathindex/merge", test_merge);
+  g_test_add_func ("/pathindex/bloom", test_bloom);
+return g_test_run ();
+}
@@ -0,0 +1,1150 @@
+/* Copyright 2023 MarcosHCK
+ * This file is part of LPacked.
+ *
+ * LPacked is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * LPacked is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with LPacked. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <config.h>
+#include <builder.h>
+#include <format.h>
+#include <packfile.h>
+#include <reader.h>
+#include <string.h>
+
+/* large enough to span several xz blocks (see LP_PACK_BLOCK_SIZE) */
+#define large_size ((3 << 20) + 123)
+
+typedef struct _Sample Sample;
+typedef struct _TestStream TestStream;
+typedef struct _TestStreamClass TestStreamClass;
+
+struct _Sample
+{
+  const gchar* path;
+  gsize size;
+};
+
+/*
+ * A stream which can only be read once, from start to end,
+ * as a pipe or a socket would be
+ */
+struct _TestStream
+{
+  GInputStream parent;
+  GBytes* bytes;
+  gsize position;
+};
+
+struct _TestStreamClass
+{
+  GInputStreamClass parent;
+};
+
+static const Sample samples [] =
+{
+  { "/empty", 0, },
+  { "/small.txt", 17, },
+  { "/dir/medium.bin", 70000, },
+  { "/dir/sub/large.bin", large_size, },
+};
+
+G_DEFINE_TYPE (TestStream, test_stream, G_TYPE_INPUT_STREAM);
+
+static gssize test_stream_class_read_fn (GInputStream* pself, void* buffer, gsize count, GCancellable* cancellable, GError** error)
+{
+  TestStream* self = (gpointer) pself;
+  gsize size, take;
+  const guint8* data = g_bytes_get_data (self->bytes, &size);
+
+  take = MIN (count, size - self->position);
+  memcpy (buffer, data + self->position, take);
+return (self->position += take, (gssize) take);
+}
+
+static void test_stream_class_finalize (GObject* pself)
+{
+  g_bytes_unref (((TestStream*) pself)->bytes);
+  G_OBJECT_CLASS (test_stream_parent_class)->finalize (pself);
+}
+
+static void test_stream_class_init (TestStreamClass* klass)
+{
+  G_INPUT_STREAM_CLASS (klass)->read_fn = test_stream_class_read_fn;
+  G_OBJECT_CLASS (klass)->finalize = test_stream_class_finalize;
+}
+
+static void test_stream_init (TestStream* self)
+{
+}
+
+static GInputStream* test_stream_new (GBytes* bytes)
+{
+  TestStream* self = g_object_new (test_stream_get_type (), NULL);
+  self->bytes = g_bytes_ref (bytes);
+return G_INPUT_STREAM (self);
+}
+
+static GBytes* makedata (const Sample* sample)
+{
+  GRand* rand = g_rand_new_with_seed ((guint32) sample->size);
+  guint8* data = g_malloc (sample->size);
+  gsize i;
+
+  /* random enough for blocks to differ, still quick to compress */
+  for (i = 0; i < sample->size; ++i)
+    data [i] = "lpacked" [g_rand_int_range (rand, 0, 7)] ^ (guint8) (i >> 16);
+
+  g_rand_free (rand);
+return g_bytes_new_take (data, sample->size);
+}
+
+static GBytes* writepack (LpPackBuilder* builder)
+{
+  GOutputStream* stream = g_memory_output_stream_new_resizable ();
+  GError* tmperr = NULL;
+  GBytes* bytes = NULL;
+
+  lp_pack_builder_write_to_stream (builder, stream, &tmperr);
+  g_assert_no_error (tmperr);
+  g_output_stream_close (stream, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+
+  bytes = g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (stream));
+  g_object_unref (builder);
+  g_object_unref (stream);
+return bytes;
+}
+
+static GBytes* makepack (LpPackLayout layout)
+{
+  LpPackBuilder* builder = g_object_new (LP_TYPE_PACK_BUILDER, "name", "test", "layout", layout, NULL);
+  GBytes* bytes = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (samples); ++i)
+    {
+      bytes = makedata (samples + i);
+      lp_pack_builder_add_from_bytes (builder, samples [i].path, bytes);
+      g_bytes_unref (bytes);
+    }
+return writepack (builder);
+}
+
+/* @files holds pairs of path and contents, ended by %NULL */
+static GBytes* packfiles (LpPackLayout layout, const gchar* const* files)
+{
+  LpPackBuilder* builder = g_object_new (LP_TYPE_PACK_BUILDER, "name", "test", "layout", layout, NULL);
+  GBytes* bytes = NULL;
+
+  for (; files [0] != NULL; files += 2)
+    {
+      bytes = g_bytes_new_static (files [1], strlen (files [1]));
+      lp_pack_builder_add_from_bytes (builder, files [0], bytes);
+      g_bytes_unref (bytes);
+    }
+return writepack (builder);
+}
+
+static void addfiles (LpPackReader* reader, gint layer, const gchar* const* files, GError** error)
+{
+  GBytes* pack = packfiles (LP_PACK_LAYOUT_RANDOM, files);
+
+  g_object_set (reader, "layer", layer, NULL);
+  lp_pack_reader_add_from_bytes (reader, pack, error);
+  g_bytes_unref (pack);
+}
+
+static void checkfile (LpPackReader* reader, const gchar* path, const gchar* contents)
+{
+  GError* tmperr = NULL;
+  GBytes* got = NULL;
+
+  got = lp_pack_reader_lookup_bytes (reader, path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_cmpmem (g_bytes_get_data (got, NULL), g_bytes_get_size (got), contents, strlen (contents));
+  g_bytes_unref (got);
+}
+
+static void checkchildren (LpPackReader* reader, const gchar* path, const gchar* const* expected)
+{
+  GError* tmperr = NULL;
+  gchar** names = NULL;
+
+  names = lp_pack_reader_enumerate_children (reader, path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_cmpstrv (names, expected);
+  g_strfreev (names);
+}
+
+static GFileType filetype (LpPackReader* reader, const gchar* path)
+{
+  GFileInfo* info = NULL;
+  GError* tmperr = NULL;
+  GFileType type;
+
+  info = lp_pack_reader_query_info (reader, path, G_FILE_ATTRIBUTE_STANDARD_TYPE, &tmperr);
+  g_assert_no_error (tmperr);
+  type = g_file_info_get_file_type (info);
+return (g_object_unref (info), type);
+}
+
+static GBytes* readall (GInputStream* stream)
+{
+  GByteArray* array = g_byte_array_new ();
+  GError* tmperr = NULL;
+  guint8 buffer [4096];
+  gssize read;
+
+  while ((read = g_input_stream_read (stream, buffer, sizeof (buffer), NULL, &tmperr)) > 0)
+    g_byte_array_append (array, buffer, (guint) read);
+
+  g_assert_no_error (tmperr);
+return g_byte_array_free_to_bytes (array);
+}
+
+static void checksamples (LpPackReader* reader)
+{
+  GInputStream* stream = NULL;
+  GError* tmperr = NULL;
+  GBytes* expected = NULL;
+  GBytes* got = NULL;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (samples); ++i)
+    {
+      expected = makedata (samples + i);
+
+      got = lp_pack_reader_lookup_bytes (reader, samples [i].path, &tmperr);
+      g_assert_no_error (tmperr);
+      g_assert_true (g_bytes_equal (expected, got));
+      g_bytes_unref (got);
+
+      stream = lp_pack_reader_open (reader, samples [i].path, &tmperr);
+      g_assert_no_error (tmperr);
+      got = readall (stream);
+      g_assert_true (g_bytes_equal (expected, got));
+      g_bytes_unref (got);
+      g_object_unref (stream);
+      g_bytes_unref (expected);
+    }
+
+  g_assert_false (lp_pack_reader_contains (reader, "/missing"));
+}
+
+static void test_roundtrip (gconstpointer user_data)
+{
+  const LpPackLayout layout = GPOINTER_TO_UINT (user_data);
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* pack = makepack (layout);
+  GError* tmperr = NULL;
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+  checksamples (reader);
+
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static GFile* writetemp (GBytes* pack)
+{
+  GFileIOStream* iostream = NULL;
+  GError* tmperr = NULL;
+  GFile* file = NULL;
+
+  file = g_file_new_tmp ("lpacked-XXXXXX.lpack", &iostream, &tmperr);
+  g_assert_no_error (tmperr);
+  g_output_stream_write_bytes_all (g_io_stream_get_output_stream (G_IO_STREAM (iostream)), pack, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_io_stream_close (G_IO_STREAM (iostream), NULL, &tmperr);
+  g_assert_no_error (tmperr);
+return (g_object_unref (iostream), file);
+}
+
+static void test_roundtrip_file (void)
+{
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* pack = makepack (LP_PACK_LAYOUT_SOLID);
+  GFile* file = writetemp (pack);
+  GError* tmperr = NULL;
+
+  lp_pack_reader_add_from_file (reader, file, &tmperr);
+  g_assert_no_error (tmperr);
+  checksamples (reader);
+
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+/* strips the index off @pack, as solid packs made before indexes were */
+static GBytes* legacypack (GBytes* pack)
+{
+  LpPackTrailer trailer;
+  GBytes* bytes = NULL;
+  gsize size;
+  const guint8* data = g_bytes_get_data (pack, &size);
+
+  g_assert_cmpuint (size, >=, sizeof (trailer));
+  memcpy (&trailer, data + size - sizeof (trailer), sizeof (trailer));
+  g_assert_cmpmem (trailer.magic, sizeof (trailer.magic), LP_PACK_INDEX_MAGIC, sizeof (trailer.magic));
+  bytes = g_bytes_new_from_bytes (pack, 0, GUINT64_FROM_LE (trailer.length));
+return (g_bytes_unref (pack), bytes);
+}
+
+static guint64 cacheinode (GFile* file)
+{
+  gchar* uri = g_file_get_uri (file);
+  gchar* name = g_compute_checksum_for_string (G_CHECKSUM_SHA256, uri, -1);
+  gchar* path = g_build_filename (g_get_user_cache_dir (), LP_PACK_CACHE_DIR, name, NULL);
+  GFile* cache = g_file_new_for_path (path);
+  GFileInfo* info = NULL;
+  GError* tmperr = NULL;
+  guint64 inode;
+
+  /* caches are replaced as a whole, so a new inode means a new cache */
+  info = g_file_query_info (cache, G_FILE_ATTRIBUTE_UNIX_INODE, 0, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  inode = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_UNIX_INODE);
+
+  g_object_unref (info);
+  g_object_unref (cache);
+  g_free (path);
+  g_free (name);
+  g_free (uri);
+return inode;
+}
+
+static LpPackReader* readfile (GFile* file)
+{
+  LpPackReader* reader = lp_pack_reader_new ();
+  GError* tmperr = NULL;
+
+  lp_pack_reader_add_from_file (reader, file, &tmperr);
+  g_assert_no_error (tmperr);
+return reader;
+}
+
+static void test_sidecar (void)
+{
+  const gchar* other [] = { "/other.txt", "other", NULL, };
+  GBytes* pack = legacypack (makepack (LP_PACK_LAYOUT_SOLID));
+  GFile* file = writetemp (pack);
+  LpPackReader* reader = NULL;
+  GError* tmperr = NULL;
+  guint64 inode;
+
+  /* caches are written in the background, readers wait on finalize */
+  reader = readfile (file);
+  checksamples (reader);
+  g_object_unref (reader);
+  inode = cacheinode (file);
+
+  /* a cache matching the pack is loaded, not written again */
+  reader = readfile (file);
+  checksamples (reader);
+  g_object_unref (reader);
+  g_assert_cmpuint (cacheinode (file), ==, inode);
+
+  /* a cache for what the file held before is not */
+  g_bytes_unref (pack);
+  pack = legacypack (packfiles (LP_PACK_LAYOUT_SOLID, other));
+  g_file_replace_contents (file, g_bytes_get_data (pack, NULL), g_bytes_get_size (pack), NULL, FALSE, 0, NULL, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+
+  reader = readfile (file);
+  checkfile (reader, "/other.txt", "other");
+  g_assert_false (lp_pack_reader_contains (reader, "/small.txt"));
+  g_object_unref (reader);
+  g_assert_cmpuint (cacheinode (file), !=, inode);
+
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+  g_bytes_unref (pack);
+}
+
+static void checkat (GInputStream* stream, const guint8* expected, goffset offset, GSeekType type, gsize count)
+{
+  GSeekable* seekable = G_SEEKABLE (stream);
+  GError* tmperr = NULL;
+  guint8 buffer [4096];
+  gsize read = 0;
+
+  g_assert_cmpuint (count, <=, sizeof (buffer));
+  g_seekable_seek (seekable, offset, type, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+
+  offset = g_seekable_tell (seekable);
+  g_input_stream_read_all (stream, buffer, count, &read, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_cmpmem (buffer, read, expected + offset, count);
+  g_assert_cmpint (g_seekable_tell (seekable), ==, offset + count);
+}
+
+static void test_seek (gconstpointer user_data)
+{
+  const LpPackLayout layout = GPOINTER_TO_UINT (user_data);
+  const Sample* sample = samples + G_N_ELEMENTS (samples) - 1;
+  const goffset block = 1 << 20;
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* expected = makedata (sample);
+  GBytes* pack = makepack (layout);
+  GInputStream* stream = NULL;
+  GError* tmperr = NULL;
+  const guint8* data = g_bytes_get_data (expected, NULL);
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+  stream = lp_pack_reader_open (reader, sample->path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_true (G_IS_SEEKABLE (stream));
+  g_assert_true (g_seekable_can_seek (G_SEEKABLE (stream)));
+
+  /* forward, across several blocks */
+  checkat (stream, data, 2 * block + 77, G_SEEK_SET, 4096);
+  /* backward, into an earlier block */
+  checkat (stream, data, 100, G_SEEK_SET, 4096);
+  /* straddling a block boundary, both ways */
+  checkat (stream, data, 3 * block - 10, G_SEEK_SET, 20);
+  checkat (stream, data, block - 10, G_SEEK_SET, 20);
+  /* relative to both current position and end */
+  checkat (stream, data, block, G_SEEK_CUR, 1000);
+  checkat (stream, data, -5, G_SEEK_END, 5);
+  checkat (stream, data, -(goffset) sample->size, G_SEEK_END, 64);
+
+  g_object_unref (stream);
+  g_bytes_unref (expected);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static void test_seek_closed (gconstpointer user_data)
+{
+  const guint read_ahead = GPOINTER_TO_UINT (user_data);
+  const Sample* sample = samples + G_N_ELEMENTS (samples) - 1;
+  LpPackReader* reader = g_object_new (LP_TYPE_PACK_READER, "read-ahead", read_ahead, NULL);
+  GBytes* pack = makepack (LP_PACK_LAYOUT_SOLID);
+  GInputStream* stream = NULL;
+  GError* tmperr = NULL;
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+  stream = lp_pack_reader_open (reader, sample->path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_input_stream_close (stream, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+
+  g_assert_false (g_seekable_can_seek (G_SEEKABLE (stream)));
+  g_assert_false (g_seekable_seek (G_SEEKABLE (stream), 0, G_SEEK_SET, NULL, &tmperr));
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_CLOSED);
+
+  g_error_free (tmperr);
+  g_object_unref (stream);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static void test_spill (gconstpointer user_data)
+{
+  const LpPackLayout layout = GPOINTER_TO_UINT (user_data);
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* pack = makepack (layout);
+  GInputStream* stream = test_stream_new (pack);
+  GError* tmperr = NULL;
+
+  g_assert_false (G_IS_SEEKABLE (stream));
+  lp_pack_reader_add_from_stream (reader, stream, &tmperr);
+  g_assert_no_error (tmperr);
+  checksamples (reader);
+
+  g_object_unref (stream);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static void checkprefix (LpPackReader* reader, const gchar* path, const gchar* const* expected)
+{
+  GError* tmperr = NULL;
+  gchar** paths = NULL;
+
+  paths = lp_pack_reader_enumerate_prefix (reader, path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_cmpstrv (paths, expected);
+  g_strfreev (paths);
+}
+
+static void test_enumerate (void)
+{
+  const gchar* more [] = { "/dir/zzz.txt", "z", "/dir/aaa.txt", "a", NULL, };
+  const gchar* root [] = { "dir", "empty", "small.txt", NULL, };
+  const gchar* dir [] = { "medium.bin", "sub", NULL, };
+  const gchar* merged [] = { "aaa.txt", "medium.bin", "sub", "zzz.txt", NULL, };
+  const gchar* sub [] = { "large.bin", NULL, };
+  const gchar* all [] = { "dir/aaa.txt", "dir/medium.bin", "dir/sub/large.bin", "dir/zzz.txt", "empty", "small.txt", NULL, };
+  const gchar* under [] = { "dir/sub/large.bin", NULL, };
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* pack = makepack (LP_PACK_LAYOUT_SOLID);
+  GError* tmperr = NULL;
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+
+  checkchildren (reader, "/", root);
+  checkchildren (reader, "", root);
+  checkchildren (reader, "/dir", dir);
+  checkchildren (reader, "dir/sub/", sub);
+  g_assert_cmpint (filetype (reader, "/dir/sub"), ==, G_FILE_TYPE_DIRECTORY);
+
+  /* listings from every pack are merged, and kept sorted */
+  addfiles (reader, 0, more, &tmperr);
+  g_assert_no_error (tmperr);
+  checkchildren (reader, "/dir", merged);
+  checkprefix (reader, "/", all);
+  checkprefix (reader, "/dir/sub", under);
+
+  g_assert_null (lp_pack_reader_enumerate_children (reader, "/small.txt", &tmperr));
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY);
+  g_clear_error (&tmperr);
+  g_assert_null (lp_pack_reader_enumerate_prefix (reader, "/missing", &tmperr));
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&tmperr);
+
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static void test_layers (void)
+{
+  const gchar* upper [] = { "/same.txt", "upper", "/dir/upper.txt", "upper", NULL, };
+  const gchar* lower [] = { "/same.txt", "lower", "/dir/lower.txt", "lower", "/lower.txt", "lower", NULL, };
+  const gchar* root [] = { "dir", "lower.txt", "same.txt", NULL, };
+  const gchar* dir [] = { "lower.txt", "upper.txt", NULL, };
+  LpPackReader* reader = lp_pack_reader_new ();
+  GError* tmperr = NULL;
+
+  /* layers win regardless of the order packs are added in */
+  addfiles (reader, 1, upper, &tmperr);
+  g_assert_no_error (tmperr);
+  addfiles (reader, 0, lower, &tmperr);
+  g_assert_no_error (tmperr);
+
+  checkfile (reader, "/same.txt", "upper");
+  checkfile (reader, "/lower.txt", "lower");
+  checkfile (reader, "/dir/upper.txt", "upper");
+  checkfile (reader, "/dir/lower.txt", "lower");
+  checkchildren (reader, "/", root);
+  checkchildren (reader, "/dir", dir);
+  g_object_unref (reader);
+}
+
+static void test_layers_clash (gconstpointer user_data)
+{
+  const gboolean file_first = GPOINTER_TO_INT (user_data);
+  const gchar* file [] = { "/a", "file", NULL, };
+  const gchar* dir [] = { "/a/b/c.txt", "dir", NULL, };
+  const gchar* root [] = { "a", NULL, };
+  LpPackReader* reader = lp_pack_reader_new ();
+  GError* tmperr = NULL;
+
+  /* whichever comes second is refused, on a higher layer or not */
+  addfiles (reader, 0, file_first ? file : dir, &tmperr);
+  g_assert_no_error (tmperr);
+  addfiles (reader, 1, file_first ? dir : file, &tmperr);
+  g_assert_error (tmperr, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN);
+  g_clear_error (&tmperr);
+
+  checkchildren (reader, "/", root);
+
+  if (file_first)
+    {
+      g_assert_cmpint (filetype (reader, "/a"), ==, G_FILE_TYPE_REGULAR);
+      g_assert_false (lp_pack_reader_contains (reader, "/a/b/c.txt"));
+      g_assert_null (lp_pack_reader_enumerate_children (reader, "/a", &tmperr));
+      g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY);
+      g_clear_error (&tmperr);
+      checkfile (reader, "/a", "file");
+    }
+  else
+    {
+      const gchar* a [] = { "b", NULL, };
+
+      g_assert_cmpint (filetype (reader, "/a"), ==, G_FILE_TYPE_DIRECTORY);
+      checkchildren (reader, "/a", a);
+      checkfile (reader, "/a/b/c.txt", "dir");
+    }
+
+  g_object_unref (reader);
+}
+
+static void test_gfile (void)
+{
+  const gchar* dir [] = { "medium.bin", "sub", NULL, };
+  const Sample* sample = samples + 2;
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* pack = makepack (LP_PACK_LAYOUT_SOLID);
+  GBytes* expected = makedata (sample);
+  GFileEnumerator* enumerator = NULL;
+  GFileInputStream* stream = NULL;
+  GFileInfo* info = NULL;
+  GError* tmperr = NULL;
+  GFile* child = NULL;
+  GFile* file = NULL;
+  GFile* parent = NULL;
+  GBytes* got = NULL;
+  gchar* string = NULL;
+  guint i;
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+  lp_pack_file_register ("test", reader);
+
+  /* plain GIO callers resolve registered names */
+  file = g_file_new_for_uri ("lpack://test//dir/./medium.bin");
+  g_assert_true (LP_IS_PACK_FILE (file));
+  g_assert_true (lp_pack_file_get_reader (LP_PACK_FILE (file)) == reader);
+  g_assert_true (g_file_has_uri_scheme (file, LP_PACK_FILE_SCHEME));
+  g_assert_false (g_file_is_native (file));
+  g_assert_null (g_file_get_path (file));
+  g_assert_cmpstr ((string = g_file_get_uri (file)), ==, "lpack://test/dir/medium.bin");
+  g_free (string);
+  g_assert_cmpstr ((string = g_file_get_basename (file)), ==, "medium.bin");
+  g_free (string);
+
+  got = g_file_load_bytes (file, NULL, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_true (g_bytes_equal (expected, got));
+  g_bytes_unref (got);
+
+  stream = g_file_read (file, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_true (g_seekable_can_seek (G_SEEKABLE (stream)));
+  checkat (G_INPUT_STREAM (stream), g_bytes_get_data (expected, NULL), 65000, G_SEEK_SET, 4096);
+  checkat (G_INPUT_STREAM (stream), g_bytes_get_data (expected, NULL), -60000, G_SEEK_CUR, 4096);
+  checkat (G_INPUT_STREAM (stream), g_bytes_get_data (expected, NULL), -100, G_SEEK_END, 100);
+  info = g_file_input_stream_query_info (stream, G_FILE_ATTRIBUTE_STANDARD_SIZE, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_cmpint (g_file_info_get_size (info), ==, sample->size);
+  g_object_unref (info);
+  g_object_unref (stream);
+
+  /* parents, children and relative paths stay in the pack */
+  parent = g_file_get_parent (file);
+  g_assert_cmpstr ((string = g_file_get_uri (parent)), ==, "lpack://test/dir");
+  g_free (string);
+  g_assert_true (g_file_has_prefix (file, parent));
+  g_assert_cmpstr ((string = g_file_get_relative_path (parent, file)), ==, "medium.bin");
+  g_free (string);
+  child = g_file_get_child (parent, "medium.bin");
+  g_assert_true (g_file_equal (child, file));
+  g_assert_cmpuint (g_file_hash (child), ==, g_file_hash (file));
+  g_object_unref (child);
+  child = g_file_resolve_relative_path (parent, "sub/../../small.txt");
+  g_assert_cmpstr ((string = g_file_get_uri (child)), ==, "lpack://test/small.txt");
+  g_free (string);
+  g_object_unref (child);
+
+  g_assert_cmpint (g_file_query_file_type (parent, 0, NULL), ==, G_FILE_TYPE_DIRECTORY);
+  g_assert_cmpint (g_file_query_file_type (file, 0, NULL), ==, G_FILE_TYPE_REGULAR);
+
+  enumerator = g_file_enumerate_children (parent, G_FILE_ATTRIBUTE_STANDARD_NAME "," G_FILE_ATTRIBUTE_STANDARD_TYPE, 0, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+
+  for (i = 0; (info = g_file_enumerator_next_file (enumerator, NULL, &tmperr)) != NULL; ++i)
+    {
+      g_assert_nonnull (dir [i]);
+      g_assert_cmpstr (g_file_info_get_name (info), ==, dir [i]);
+      g_assert_cmpint (g_file_info_get_file_type (info), ==, i == 0 ? G_FILE_TYPE_REGULAR : G_FILE_TYPE_DIRECTORY);
+      g_object_unref (info);
+    }
+
+  g_assert_no_error (tmperr);
+  g_assert_null (dir [i]);
+  g_object_unref (enumerator);
+
+  /* the root has no parent */
+  child = g_file_get_parent (parent);
+  g_assert_cmpstr ((string = g_file_get_uri (child)), ==, "lpack://test/");
+  g_free (string);
+  g_assert_null (g_file_get_parent (child));
+  g_object_unref (child);
+  g_object_unref (parent);
+
+  child = g_file_new_for_uri ("lpack://test/missing");
+  g_assert_null (g_file_read (child, NULL, &tmperr));
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&tmperr);
+  g_object_unref (child);
+
+  /* files made before unregistering keep working */
+  lp_pack_file_unregister ("test");
+  child = g_file_new_for_uri ("lpack://test/dir/medium.bin");
+  g_assert_false (LP_IS_PACK_FILE (child));
+  g_object_unref (child);
+
+  got = g_file_load_bytes (file, NULL, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_true (g_bytes_equal (expected, got));
+  g_bytes_unref (got);
+
+  g_object_unref (file);
+  g_bytes_unref (expected);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static void addtemps (LpPackReader* reader, gint layer, const gchar* const* const* packs, guint n_packs, GError** error)
+{
+  GFile** files = g_new0 (GFile*, n_packs);
+  GBytes* pack = NULL;
+  guint i;
+
+  /* a %NULL pack stands for a file which does not exist */
+  for (i = 0; i < n_packs; ++i)
+    {
+      if (packs [i] == NULL)
+        files [i] = g_file_new_for_path ("/nonexistent/lpacked/missing.lpack");
+      else
+        {
+          pack = packfiles (LP_PACK_LAYOUT_SOLID, packs [i]);
+          files [i] = writetemp (pack);
+          g_bytes_unref (pack);
+        }
+    }
+
+  g_object_set (reader, "layer", layer, NULL);
+  lp_pack_reader_add_from_files (reader, files, n_packs, error);
+
+  for (i = 0; i < n_packs; ++i)
+    {
+      g_file_delete (files [i], NULL, NULL);
+      g_object_unref (files [i]);
+    }
+
+  g_free (files);
+}
+
+static void test_add_files (void)
+{
+  const gchar* first [] = { "/same.txt", "first", "/first.txt", "first", NULL, };
+  const gchar* second [] = { "/same.txt", "second", "/second.txt", "second", NULL, };
+  const gchar* third [] = { "/same.txt", "third", "/third.txt", "third", NULL, };
+  const gchar* clash [] = { "/first.txt/sub.txt", "clash", NULL, };
+  const gchar* lower [] = { "/same.txt", "lower", "/lower.txt", "lower", NULL, };
+  const gchar* const* ordered [] = { first, second, third, };
+  const gchar* const* missing [] = { second, NULL, third, };
+  const gchar* const* failing [] = { clash, NULL, third, };
+  const gchar* const* layered [] = { lower, };
+  const gchar* root [] = { "first.txt", "lower.txt", "same.txt", "second.txt", "third.txt", NULL, };
+  LpPackReader* reader = lp_pack_reader_new ();
+  GError* tmperr = NULL;
+
+  g_assert_true (lp_pack_reader_add_from_files (reader, NULL, 0, &tmperr));
+  g_assert_no_error (tmperr);
+
+  /* later files shadow earlier ones, however scans are scheduled */
+  addtemps (reader, 1, ordered, G_N_ELEMENTS (ordered), &tmperr);
+  g_assert_no_error (tmperr);
+  checkfile (reader, "/same.txt", "third");
+  checkfile (reader, "/first.txt", "first");
+  checkfile (reader, "/second.txt", "second");
+  checkfile (reader, "/third.txt", "third");
+
+  /* ... but not files on a higher layer */
+  addtemps (reader, 0, layered, G_N_ELEMENTS (layered), &tmperr);
+  g_assert_no_error (tmperr);
+  checkfile (reader, "/same.txt", "third");
+  checkfile (reader, "/lower.txt", "lower");
+  checkchildren (reader, "/", root);
+  g_object_unref (reader);
+
+  /* files before the first failure are added, none after it */
+  reader = lp_pack_reader_new ();
+  addtemps (reader, 0, missing, G_N_ELEMENTS (missing), &tmperr);
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&tmperr);
+  checkfile (reader, "/same.txt", "second");
+  g_assert_false (lp_pack_reader_contains (reader, "/third.txt"));
+
+  /* the error reported is the one of the first failing file */
+  addtemps (reader, 0, ordered, 1, &tmperr);
+  g_assert_no_error (tmperr);
+  addtemps (reader, 0, failing, G_N_ELEMENTS (failing), &tmperr);
+  g_assert_error (tmperr, LP_PACK_READER_ERROR, LP_PACK_READER_ERROR_SCAN);
+  g_clear_error (&tmperr);
+  checkfile (reader, "/same.txt", "first");
+  g_assert_false (lp_pack_reader_contains (reader, "/first.txt/sub.txt"));
+  g_assert_false (lp_pack_reader_contains (reader, "/third.txt"));
+  g_object_unref (reader);
+}
+
+static void checklookup (LpPackReader* reader, const Sample* sample)
+{
+  GBytes* expected = makedata (sample);
+  GError* tmperr = NULL;
+  GBytes* got = NULL;
+
+  got = lp_pack_reader_lookup_bytes (reader, sample->path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_true (g_bytes_equal (expected, got));
+  g_bytes_unref (expected);
+  g_bytes_unref (got);
+}
+
+static void checkcounts (LpPackReader* reader, guint64 hits, guint64 misses)
+{
+  guint64 got_hits, got_misses;
+
+  g_object_get (reader, "cache-hits", &got_hits, "cache-misses", &got_misses, NULL);
+  g_assert_cmpuint (got_hits, ==, hits);
+  g_assert_cmpuint (got_misses, ==, misses);
+}
+
+static void test_cache (void)
+{
+  const Sample* small = samples + 1;
+  const Sample* medium = samples + 2;
+  const Sample* large = samples + 3;
+  LpPackReader* reader = g_object_new (LP_TYPE_PACK_READER, "cache-budget", (guint64) 100000, NULL);
+  GBytes* pack = makepack (LP_PACK_LAYOUT_SOLID);
+  GError* tmperr = NULL;
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+
+  checklookup (reader, medium);
+  checklookup (reader, medium);
+  checkcounts (reader, 1, 1);
+  checklookup (reader, small);
+  checkcounts (reader, 1, 2);
+
+  /* larger than the whole budget, never kept */
+  checklookup (reader, large);
+  checklookup (reader, large);
+  checkcounts (reader, 1, 4);
+
+  /* shrinking the budget evicts the least recently used first */
+  g_object_set (reader, "cache-budget", (guint64) 50000, NULL);
+  checklookup (reader, small);
+  checkcounts (reader, 2, 4);
+  checklookup (reader, medium);
+  checkcounts (reader, 2, 5);
+
+  /* no budget, no cache */
+  g_object_set (reader, "cache-budget", (guint64) 0, NULL);
+  checklookup (reader, small);
+  checkcounts (reader, 2, 5);
+
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static gboolean collect (const gchar* path, GBytes* contents, gpointer user_data)
+{
+  g_assert_false (g_hash_table_contains (user_data, path));
+  g_hash_table_insert (user_data, g_strdup (path), g_bytes_ref (contents));
+return TRUE;
+}
+
+static gboolean collectone (const gchar* path, GBytes* contents, gpointer user_data)
+{
+  return (collect (path, contents, user_data), FALSE);
+}
+
+static gboolean indir (const gchar* path, gpointer user_data)
+{
+  return g_str_has_prefix (path, "dir/");
+}
+
+/* batch functions are passed paths as packed, that is, relative */
+static void checkcollected (GHashTable* got, guint first, guint last)
+{
+  GBytes* expected = NULL;
+  guint i;
+
+  g_assert_cmpuint (g_hash_table_size (got), ==, last - first);
+
+  for (i = first; i < last; ++i)
+    {
+      expected = makedata (samples + i);
+      g_assert_true (g_bytes_equal (expected, g_hash_table_lookup (got, samples [i].path + 1)));
+      g_bytes_unref (expected);
+    }
+
+  g_hash_table_remove_all (got);
+}
+
+static void test_batch (gconstpointer user_data)
+{
+  const LpPackLayout layout = GPOINTER_TO_UINT (user_data);
+  const gchar* all [] = { "/dir/sub/large.bin", "small.txt", "/empty", "/dir/medium.bin", NULL, };
+  const gchar* missing [] = { "/small.txt", "/missing", NULL, };
+  GHashTable* got = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_bytes_unref);
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* pack = makepack (layout);
+  GError* tmperr = NULL;
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+
+  g_assert_true (lp_pack_reader_extract_many (reader, all, collect, got, &tmperr));
+  g_assert_no_error (tmperr);
+  checkcollected (got, 0, G_N_ELEMENTS (samples));
+
+  /* nothing is extracted unless every path is there */
+  g_assert_false (lp_pack_reader_extract_many (reader, missing, collect, got, &tmperr));
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_cmpuint (g_hash_table_size (got), ==, 0);
+  g_clear_error (&tmperr);
+
+  g_assert_true (lp_pack_reader_extract_many (reader, all, collectone, got, &tmperr));
+  g_assert_no_error (tmperr);
+  g_assert_cmpuint (g_hash_table_size (got), ==, 1);
+  g_hash_table_remove_all (got);
+
+  /* the manifest is no packed file */
+  g_assert_true (lp_pack_reader_foreach (reader, NULL, collect, got, &tmperr));
+  g_assert_no_error (tmperr);
+  checkcollected (got, 0, G_N_ELEMENTS (samples));
+
+  g_assert_true (lp_pack_reader_foreach (reader, indir, collect, got, &tmperr));
+  g_assert_no_error (tmperr);
+  checkcollected (got, 2, G_N_ELEMENTS (samples));
+
+  g_hash_table_unref (got);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static gpointer readsamples (gpointer reader)
+{
+  guint i;
+
+  for (i = 0; i < 2; ++i)
+    checksamples (reader);
+return NULL;
+}
+
+static void test_threads (gconstpointer user_data)
+{
+  const LpPackLayout layout = GPOINTER_TO_UINT (user_data);
+  const gchar* other [] = { "/other.txt", "other", NULL, };
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* pack = makepack (layout);
+  GThread* threads [4];
+  GError* tmperr = NULL;
+  guint i;
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+
+  for (i = 0; i < G_N_ELEMENTS (threads); ++i)
+    threads [i] = g_thread_new ("reader", readsamples, reader);
+
+  /* settings change and packs come in while others read */
+  for (i = 0; i < 64; ++i)
+    g_object_set (reader, "cache-budget", (guint64) (i % 2) * 100000, "read-ahead", i % 3, NULL);
+
+  addfiles (reader, 1, other, &tmperr);
+  g_assert_no_error (tmperr);
+
+  for (i = 0; i < G_N_ELEMENTS (threads); ++i)
+    g_thread_join (threads [i]);
+
+  checkfile (reader, "/other.txt", "other");
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static void on_ready (GObject* pself, GAsyncResult* result, gpointer user_data)
+{
+  *(GAsyncResult**) user_data = g_object_ref (result);
+}
+
+/* iterates the default context until the operation completes */
+static GAsyncResult* waitresult (GAsyncResult** result)
+{
+  while (*result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+return g_steal_pointer (result);
+}
+
+static void test_async (void)
+{
+  const Sample* sample = samples + G_N_ELEMENTS (samples) - 1;
+  LpPackReader* reader = lp_pack_reader_new ();
+  GBytes* expected = makedata (sample);
+  GBytes* pack = makepack (LP_PACK_LAYOUT_SOLID);
+  GFile* file = writetemp (pack);
+  GAsyncResult* result = NULL;
+  GCancellable* cancellable = NULL;
+  GInputStream* stream = NULL;
+  GFileInfo* info = NULL;
+  GError* tmperr = NULL;
+  GBytes* got = NULL;
+
+  lp_pack_reader_add_from_file_async (reader, file, G_PRIORITY_DEFAULT, NULL, on_ready, &result);
+  g_assert_true (lp_pack_reader_add_from_file_finish (reader, waitresult (&result), &tmperr));
+  g_assert_no_error (tmperr);
+  g_clear_object (&result);
+
+  lp_pack_reader_query_info_async (reader, sample->path, G_FILE_ATTRIBUTE_STANDARD_SIZE, G_PRIORITY_DEFAULT, NULL, on_ready, &result);
+  info = lp_pack_reader_query_info_finish (reader, waitresult (&result), &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_cmpint (g_file_info_get_size (info), ==, sample->size);
+  g_clear_object (&result);
+
+  lp_pack_reader_open_async (reader, sample->path, G_PRIORITY_DEFAULT, NULL, on_ready, &result);
+  stream = lp_pack_reader_open_finish (reader, waitresult (&result), &tmperr);
+  g_assert_no_error (tmperr);
+  got = readall (stream);
+  g_assert_true (g_bytes_equal (expected, got));
+  g_clear_object (&result);
+
+  lp_pack_reader_open_async (reader, "/missing", G_PRIORITY_DEFAULT, NULL, on_ready, &result);
+  g_assert_null (lp_pack_reader_open_finish (reader, waitresult (&result), &tmperr));
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_object (&result);
+  g_clear_error (&tmperr);
+
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+  lp_pack_reader_open_async (reader, sample->path, G_PRIORITY_DEFAULT, cancellable, on_ready, &result);
+  g_assert_null (lp_pack_reader_open_finish (reader, waitresult (&result), &tmperr));
+  g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_object (&result);
+  g_clear_error (&tmperr);
+
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (cancellable);
+  g_object_unref (info);
+  g_object_unref (stream);
+  g_object_unref (file);
+  g_bytes_unref (got);
+  g_bytes_unref (expected);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+static gboolean on_readable (GObject* pollable, gpointer user_data)
+{
+  return (*(gboolean*) user_data = TRUE, G_SOURCE_REMOVE);
+}
+
+static GBytes* readpolling (GInputStream* stream)
+{
+  GPollableInputStream* pollable = G_POLLABLE_INPUT_STREAM (stream);
+  GByteArray* array = g_byte_array_new ();
+  GError* tmperr = NULL;
+  GSource* source = NULL;
+  guint8 buffer [4096];
+  gboolean ready;
+  gssize read;
+
+  while ((read = g_pollable_input_stream_read_nonblocking (pollable, buffer, sizeof (buffer), NULL, &tmperr)) != 0)
+    {
+      if (read > 0)
+        g_byte_array_append (array, buffer, (guint) read);
+      else
+        {
+          g_assert_error (tmperr, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK);
+          g_clear_error (&tmperr);
+
+          ready = FALSE;
+          source = g_pollable_input_stream_create_source (pollable, NULL);
+          g_source_set_callback (source, (GSourceFunc) on_readable, &ready, NULL);
+          g_source_attach (source, NULL);
+
+          while (ready == FALSE)
+            g_main_context_iteration (NULL, TRUE);
+
+          g_source_destroy (source);
+          g_source_unref (source);
+        }
+    }
+return g_byte_array_free_to_bytes (array);
+}
+
+static void test_read_ahead (void)
+{
+  const Sample* sample = samples + G_N_ELEMENTS (samples) - 1;
+  LpPackReader* reader = g_object_new (LP_TYPE_PACK_READER, "read-ahead", 4, NULL);
+  GBytes* expected = makedata (sample);
+  GBytes* pack = makepack (LP_PACK_LAYOUT_SOLID);
+  GInputStream* stream = NULL;
+  GError* tmperr = NULL;
+  GSource* source = NULL;
+  GBytes* got = NULL;
+  guint8 buffer [16];
+
+  lp_pack_reader_add_from_bytes (reader, pack, &tmperr);
+  g_assert_no_error (tmperr);
+  checksamples (reader);
+
+  stream = lp_pack_reader_open (reader, sample->path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_true (G_IS_POLLABLE_INPUT_STREAM (stream));
+  g_assert_true (g_pollable_input_stream_can_poll (G_POLLABLE_INPUT_STREAM (stream)));
+  got = readpolling (stream);
+  g_assert_true (g_bytes_equal (expected, got));
+  g_bytes_unref (got);
+  g_object_unref (stream);
+
+  /* sources dropped early and streams closed midway leave nothing behind */
+  stream = lp_pack_reader_open (reader, sample->path, &tmperr);
+  g_assert_no_error (tmperr);
+  g_input_stream_read_all (stream, buffer, sizeof (buffer), NULL, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_assert_cmpmem (buffer, sizeof (buffer), g_bytes_get_data (expected, NULL), sizeof (buffer));
+  source = g_pollable_input_stream_create_source (G_POLLABLE_INPUT_STREAM (stream), NULL);
+  g_source_unref (source);
+  g_input_stream_close (stream, NULL, &tmperr);
+  g_assert_no_error (tmperr);
+  g_object_unref (stream);
+
+  g_bytes_unref (expected);
+  g_bytes_unref (pack);
+  g_object_unref (reader);
+}
+
+int main (int argc, char* argv [])
+{
+  /* keeps pack caches (see test_sidecar) out of the user's */
+  g_test_init (&argc, &argv, G_TEST_OPTION_ISOLATE_DIRS, NULL);
+
+  g_test_add_data_func ("/reader/roundtrip/solid", GUINT_TO_POINTER (LP_PACK_LAYOUT_SOLID), test_roundtrip);
+  g_test_add_data_func ("/reader/roundtrip/random", GUINT_TO_POINTER (LP_PACK_LAYOUT_RANDOM), test_roundtrip);
+  g_test_add_data_func ("/reader/roundtrip/stored", GUINT_TO_POINTER (LP_PACK_LAYOUT_STORED), test_roundtrip);
+  g_test_add_func ("/reader/roundtrip/file", test_roundtrip_file);
+  g_test_add_data_func ("/reader/seek/solid", GUINT_TO_POINTER (LP_PACK_LAYOUT_SOLID), test_seek);
+  g_test_add_data_func ("/reader/seek/random", GUINT_TO_POINTER (LP_PACK_LAYOUT_RANDOM), test_seek);
+  g_test_add_data_func ("/reader/seek/closed", GUINT_TO_POINTER (0), test_seek_closed);
+  g_test_add_data_func ("/reader/seek/closed-read-ahead", GUINT_TO_POINTER (4), test_seek_closed);
+  g_test_add_data_func ("/reader/spill/solid", GUINT_TO_POINTER (LP_PACK_LAYOUT_SOLID), test_spill);
+  g_test_add_data_func ("/reader/spill/random", GUINT_TO_POINTER (LP_PACK_LAYOUT_RANDOM), test_spill);
+  g_test_add_func ("/reader/sidecar", test_sidecar);
+  g_test_add_func ("/reader/cache", test_cache);
+  g_test_add_data_func ("/reader/batch/solid", GUINT_TO_POINTER (LP_PACK_LAYOUT_SOLID), test_batch);
+  g_test_add_data_func ("/reader/batch/random", GUINT_TO_POINTER (LP_PACK_LAYOUT_RANDOM), test_batch);
+  g_test_add_data_func ("/reader/threads/solid", GUINT_TO_POINTER (LP_PACK_LAYOUT_SOLID), test_threads);
+  g_test_add_data_func ("/reader/threads/random", GUINT_TO_POINTER (LP_PACK_LAYOUT_RANDOM), test_threads);
+  g_test_add_func ("/reader/async", test_async);
+  g_test_add_func ("/reader/read-ahead", test_read_ahead);
+  g_test_add_func ("/reader/enumerate", test_enumerate);
+  g_test_add_func ("/reader/gfile", test_gfile);
+  g_test_add_func ("/reader/layers/shadow", test_layers);
+  g_test_add_func ("/reader/add-files", test_add_files);
+  g_test_add_data_func ("/reader/layers/clash/file-first", GINT_TO_POINTER (TRUE), test_layers_clash);
+  g_test_add_data_func ("/reader/layers/clash/dir-first", GINT_TO_POINTER (FALSE), test_layers_clash);
+return g_test_run ();
+}